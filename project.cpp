@@ -1,618 +1,6960 @@
-/*
-* File          :  project.cpp
-* Project       :  Parcel Management System Using Hash Table and Binary Search Tree.
-* Programmer    :  Prit Patel (8979395)
-                           : Vruti Mistry (8963142)
-* First version : 2024-08-07
-* Description   : This program handles parcel data for delivery service, saving and
-*                 retrieving parcels based on destination country. This hash
-*                 table mapping country names maps them to binary search trees which
-*                 organize parcels by weight.
-*                 The system supports the following operations: displaying of all parcels
-*                 for a country, filtering parcels by weight, calculation of the total load
-*                 and valuation for a country, and identifying the cheapest, most expensive,
-*                 lightest, and heaviest parcels.
-*/
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <fstream>
-
-#pragma warning(disable: 4996)
-#define HASH_TABLE_SIZE 127
-#define MAX_COUNTRY_NAME_LENGTH 20  
-
-using namespace std;
-
-// Define a struct to represent a parcel
-struct Parcel {
-    char* country;      // Pointer to store the country name (destination)
-    int weight;        // Weight of the parcel
-    float valuation;   // Valuation of the parcel
-    // Constructor to initialize a Parcel object with the country name, weight, and valuation
-
-    Parcel(const char* c, int w, float v) : weight(w), valuation(v) {
-        // Allocate memory for the country name, with space for the null terminator
-        country = (char*)malloc(MAX_COUNTRY_NAME_LENGTH + 1);  // Allocate memory for MAX_COUNTRY_NAME_LENGTH characters + null terminator
-        if (country) {
-            // Copy the provided country name into the allocated memory, ensuring no buffer overflow
-            strncpy_s(country, MAX_COUNTRY_NAME_LENGTH + 1, c, MAX_COUNTRY_NAME_LENGTH);  // Safe copy up to MAX_COUNTRY_NAME_LENGTH characters
-        }
-    }
-    // Destructor to free the allocated memory for the country name
-    ~Parcel() {
-        free(country);  // Free the allocated memory
-    }
-};
-
-// Define a struct to represent a node in a Binary Search Tree (BST)
-// This node will store a pointer to a Parcel and pointers to its left and right children
-struct BSTDataNode {
-    Parcel* parcel;     // Pointer to the parcel
-    BSTDataNode* left;      // Left child
-    BSTDataNode* right;     // Right child
-    // Constructor to initialize a BSTDataNode with a given Parcel
-    BSTDataNode(Parcel* p) : parcel(p), left(nullptr), right(nullptr) {}
-};
-
-// Define a struct for a Binary Search Tree 
-// The BST is used to store and manage Parcel objects based on their weight
-struct BST {
-    BSTDataNode* root;      // Root node of the BST
-    // Constructor to initialize an empty BST
-    BST() : root(nullptr) {}
-    // Function to insert a Parcel into the BST based on its weight
-    void insert(Parcel* parcel) {
-        root = insertIntoTree(root, parcel);
-    }
-    // Function to perform an inorder traversal of the BST
-    // The function fills the parcels array with pointers to the Parcel objects in sorted order
-    void inorder(Parcel**& parcels, int& count, int& capacity) {
-        inorderTraversal(root, parcels, count, capacity);
-    }
-    // Helper function to insert a Parcel into the BST, used recursively
-    BSTDataNode* insertIntoTree(BSTDataNode* node, Parcel* parcel) {
-        if (!node) {
-            return new BSTDataNode(parcel);
-        }
-        if (parcel->weight < node->parcel->weight) {
-            // Insert the parcel into the left subtree if its weight is less than the current node's parcel
-            node->left = insertIntoTree(node->left, parcel);
-        }
-        else {
-            node->right = insertIntoTree(node->right, parcel);
-        }
-        return node;
-    }
-    // Recursive function to perform an inorder traversal of the BST
-// This function populates an array with pointers to Parcel objects in sorted order
-    void inorderTraversal(BSTDataNode* node, Parcel**& parcels, int& count, int& capacity) {
-        // Base case: If the current node is null, return from the function
-        if (node) {
-            // Recursively traverse the left subtree
-            inorderTraversal(node->left, parcels, count, capacity);
-
-            // Check if the parcels array has reached its capacity
-            if (count >= capacity) {
-                // Double the capacity of the array to accommodate more Parcel pointers
-                capacity *= 2;
-                // Allocate more memory for the expanded array
-                Parcel** temp = (Parcel**)realloc(parcels, capacity * sizeof(Parcel*));
-
-                // If memory allocation fails, free the existing array and set parcels to null
-                if (!temp) {
-                    free(parcels);
-                    parcels = nullptr;
-                    return;  // Exit the function if memory allocation fails
-                }
-
-                // Update the parcels pointer to point to the newly allocated memory
-                parcels = temp;
-            }
-
-            // Add the current node's parcel to the parcels array and increment the count
-            parcels[count++] = node->parcel;
-
-            // Recursively traverse the right subtree
-            inorderTraversal(node->right, parcels, count, capacity);
-        }
-    }
-
-    // Destructor to clean up the BST by deleting all its nodes
-    ~BST() {
-        deleteTree(root);
-    }
-    // function to delete all nodes in the BST recursively
-
-    void deleteTree(BSTDataNode* node) {
-        if (node) {
-            deleteTree(node->left); // Delete the left subtree
-            deleteTree(node->right); // Delete the right subtree
-            delete node->parcel;
-            delete node;
-        }
-    }
-};
-
-// Define a struct for the Hash Table
-// The Hash Table stores BSTs, each of which manages parcels for a specific hash value
-struct HashTable {
-    BST* table[HASH_TABLE_SIZE];
-
-    HashTable() {
-        for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
-            table[i] = new BST();
-        }
-    }
-    // Hash function to compute the hash value of a country name
-    unsigned long hashFunction(const char* str) {
-        unsigned long hash = 5381;
-        while (*str) {
-            hash = ((hash << 5) + hash) + *str;  // hash * 33 + c
-            str++;
-        }
-        return hash % HASH_TABLE_SIZE;
-    }
-    // Function to insert a Parcel into the appropriate BST in the Hash Table
-    void insert(Parcel* parcel) {
-        unsigned long hashValue = hashFunction(parcel->country);
-        table[hashValue]->insert(parcel);
-    }
-    // Function to retrieve the BST associated with a given country name
-    BST* getTree(const char* country) {
-        unsigned long hashValue = hashFunction(country);
-        return table[hashValue];
-    }
-    // Destructor to clean up the Hash Table by deleting all BSTs
-    ~HashTable() {
-        for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
-            delete table[i];
-        }
-    }
-};
-
-// Function prototypes
-
-// Shows the details of all parcels for a given country by searching the hash table
-void showParcelsList(HashTable& hashTable, const char* country);
-
-// Displays parcels for a specific country that meet a weight condition
-// 'higher' determines whether to show parcels heavier or lighter than the specified weight
-void showParcelWeight(HashTable& hashTable, const char* country, int weight, bool higher);
-
-// Calculates and prints the total weight and valuation of all parcels for a country
-// Returns true if the country has parcels, false otherwise
-bool checkTotalLoadAndValuation(HashTable& hashTable, const char* country);
-
-// Displays the cheapest and most expensive parcels for a given country
-void showCost(HashTable& hashTable, const char* country);
-
-// Finds and displays the lightest and heaviest parcels for a specific country
-void lightestAndHeaviest(HashTable& hashTable, const char* country);
-
-// Reads parcel data from a file and adds them to the hash table
-void readFile(HashTable& hashTable, const char* filename);
-
-// Prompts the user for input with a given prompt and stores it in 'buffer'
-// Removes any trailing newline characters from the input
-void getUserInput(const char* prompt, char* buffer, int size);
-
-int main() {
-    // Create a hash table to store parcels
-    HashTable hashTable;
-
-    // Read parcel data from the couriers.txt file and populate the hash table
-    readFile(hashTable, "couriers.txt");
-    // Variable to store user choice from the menu
-    int choice;
-    char country[MAX_COUNTRY_NAME_LENGTH];
-    char input[100];
-    // Variable to store the weight 
-    int weight;
-
-    do {
-        // Display the user menu with options
-        printf("\nUser Menu:\n");
-        printf("----------\n");
-        printf("1. Enter country name and display all the parcels details\n");
-        printf("2. Enter country and weight pair\n");
-        printf("3. Display the total parcel load and valuation for the country\n");
-        printf("4. Enter the country name and display cheapest and most expensive parcel’s details\n");
-        printf("5. Enter the country name and display lightest and heaviest parcel for the country\n");
-        printf("6. Exit the application\n");
-        printf("\n");
-        printf("Enter your choice: ");
-
-        // Get the user's choice from the menu
-        fgets(input, sizeof(input), stdin);
-        sscanf_s(input, "%d", &choice);
-
-        switch (choice) {
-        case 1:
-            // Case 1: Display all parcel details for a given country
-            getUserInput("Enter country name: ", country, sizeof(country));
-            showParcelsList(hashTable, country);// Call function to display all parcels for the given country
-
-            break;
-        case 2:
-            // Case 2: Display parcels for a country based on weight condition
-        {
-            // Prompt for the country name
-            getUserInput("Enter country name: ", country, sizeof(country));
-
-            // Retrieve the BST associated with the given country
-            BST* tree = hashTable.getTree(country);
-
-            // Allocate memory for an array of Parcel pointers to store the retrieved parcels
-            int count = 0, capacity = 10;
-            Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-            if (!parcels) {
-                // Handle memory allocation failure
-                printf("Memory allocation failed.\n");
-                return 1; // Exit the program if memory allocation fails
-            }
-            // Perform an inorder traversal of the tree to populate the parcels array
-            tree->inorder(parcels, count, capacity);
-
-            bool found = false;
-            for (int i = 0; i < count; i++) {
-                if (strcmp(parcels[i]->country, country) == 0) {
-                    found = true;
-                    break;
-                }
-            }
-
-            if (!found) {
-                // If no parcels were found for the country, display an error message and exit the case
-                printf("\n");
-                printf("Invalid country name or no parcels found for country %s.\n", country);
-                free(parcels);
-                break;
-            }
-
-            // Prompt for the weight to compare
-            printf("Enter the weight to compare: ");
-            fgets(input, sizeof(input), stdin);
-            sscanf_s(input, "%d", &weight);
-
-            // Prompt the user to enter the weight for comparison
-            char conditionChar;
-            do {
-                printf("Enter 'H' for weight higher or 'L' for weight lower: ");
-                fgets(input, sizeof(input), stdin);
-                conditionChar = toupper(input[0]);
-
-                if (conditionChar != 'H' && conditionChar != 'L') {
-                    // If the user enters an invalid choice, display an error message
-                    printf("\n");
-                    printf("Invalid input. Please enter 'H' for higher or 'L' for lower.\n");
-                }
-            } while (conditionChar != 'H' && conditionChar != 'L');
-
-            // Determine the condition based on user input
-            bool condition = (conditionChar == 'H');
-
-            // Call the showParcelWeight function
-            showParcelWeight(hashTable, country, weight, condition);
-
-            free(parcels);
-            break;
-        }
-
-        case 3:
-            // Case 3: Display the total parcel load and valuation for a given country
-            getUserInput("Enter country name: ", country, sizeof(country));
-
-            // Check if the country has valid parcels
-            if (!checkTotalLoadAndValuation(hashTable, country)) {
-                // If no parcels are found for the country, display an error message
-                printf("\n");
-                printf("Invalid country, please try again.\n");
-            }
-            break;
-        case 4:
-            // Case 4: Display the cheapest and most expensive parcels for a given country
-            getUserInput("Enter country name: ", country, sizeof(country));
-            showCost(hashTable, country);
-            break;
-        case 5:
-            // Case 5: Display the lightest and heaviest parcels for a given country
-            getUserInput("Enter country name: ", country, sizeof(country));
-            lightestAndHeaviest(hashTable, country);
-            break;
-        case 6:
-            // Case 6: Exit the application
-            printf("\n");
-            printf("Exiting the application.\n");
-            break;
-        default:
-            // Handle invalid menu choices by displaying an error message
-            printf("\n");
-            printf("Invalid choice, please enter a number between 1 and 6.\n");
-            break;
-        }
-    } while (choice != 6); // Continue looping until the user chooses to exit
-    // Return 0 to indicate successful program termination
-    return 0;
-}
-
-
-/*
- * FUNCTION    : showParcelsList
- * DESCRIPTION : Displays all parcels for a given country by retrieving them
- *               from the binary search tree associated with that country in
- *               the hash table.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* country  - The name of the country to look up.
- */
-void showParcelsList(HashTable& hashTable, const char* country) {
-    // Retrieve the binary search tree associated with the given country
-    BST* tree = hashTable.getTree(country);
-
-    if (tree) {
-        int count = 0, capacity = 10;
-
-        // Allocate memory for an array of Parcel pointers to store the retrieved parcels
-        Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-        if (!parcels) {
-            // Handle memory allocation failure
-            printf("Memory allocation failed.\n");
-            return;
-        }
-
-        // Perform an inorder traversal to populate the parcels array
-        tree->inorder(parcels, count, capacity);
-
-        bool found = false;  // Flag to check if any parcel is found for the given country
-
-        // Iterate over all parcels and display those that match the specified country
-        for (int i = 0; i < count; i++) {
-            if (strcmp(parcels[i]->country, country) == 0) {
-                // If a matching parcel is found, print its details in the specified format
-                found = true;
-                printf("Destination:%s,Weight:%d,Valuation:%.2f\n", parcels[i]->country, parcels[i]->weight, parcels[i]->valuation);
-            }
-        }
-
-        // If no parcels were found for the country, notify the user
-        if (!found) {
-            printf("No parcels found for country %s\n", country);
-        }
-
-        // Free the allocated memory for the parcels array
-        free(parcels);
-    }
-    else {
-        // If the tree for the specified country is not found, notify the user
-        printf("No parcels found for country %s\n", country);
-    }
-}
-
-/*
- * FUNCTION    : showParcelWeight
- * DESCRIPTION : Displays parcels for a given country based on a weight
- *               condition. The function can filter parcels that are either
- *               heavier or lighter than the specified weight.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* country  - The name of the country to look up.
- *               int weight           - The weight to compare against.
- *               bool higher          - If true, shows parcels heavier than
- *                                      the specified weight; otherwise, shows
- *                                      parcels lighter than the specified weight.
- */
-void showParcelWeight(HashTable& hashTable, const char* country, int weight, bool higher) {
-    BST* tree = hashTable.getTree(country);
-
-    if (tree) {
-        int count = 0, capacity = 10;
-        Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-        if (!parcels) {
-            printf("\n");
-            printf("Memory allocation failed.\n");
-            return;
-        }
-
-        // Initialize memory to NULL
-        memset(parcels, 0, capacity * sizeof(Parcel*));
-
-        tree->inorder(parcels, count, capacity);
-
-        // Ensure the rest of the function properly handles cases where parcels might still be NULL
-        // ... (rest of the function)
-
-        free(parcels);
-    }
-    else {
-        printf("\n");
-        printf("No parcels found for country %s.\n", country);
-    }
-}
-
-/*
- * FUNCTION    : checkTotalLoadAndValuation
- * DESCRIPTION : Calculates and displays the total load (weight) and total
- *               valuation of all parcels for a specified country.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* country  - The name of the country to look up.
- * RETURNS     : bool - Returns true if the country has parcels; false otherwise.
- */
-bool checkTotalLoadAndValuation(HashTable& hashTable, const char* country) {
-    BST* tree = hashTable.getTree(country);
-    if (tree) {
-        int count = 0, capacity = 10;
-        Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-        if (!parcels) {
-            printf("\n");
-            printf("Memory allocation failed.\n");
-            return false;
-        }
-        tree->inorder(parcels, count, capacity);
-
-        int totalWeight = 0;
-        float totalValuation = 0;
-        bool found = false;
-
-        for (int i = 0; i < count; i++) {
-            if (strcmp(parcels[i]->country, country) == 0) {  // Check if the parcel's country matches the input country
-                totalWeight += parcels[i]->weight;
-                totalValuation += parcels[i]->valuation;
-                found = true;
-            }
-        }
-
-        free(parcels);
-
-        if (found) {
-            printf("\n");
-            printf("Total parcel load for country %s: %d\n", country, totalWeight);
-            printf("\n");
-            printf("Total parcel valuation for country %s: %.2f\n", country, totalValuation);
-            return true;
-        }
-    }
-
-    return false; // Return false if no parcels found for the country
-}
-
-/*
- * FUNCTION    : showCost
- * DESCRIPTION : Displays the details of the cheapest and most expensive
- *               parcels for a given country by evaluating all parcels stored
- *               in the associated binary search tree.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* country  - The name of the country to look up.
- */
-void showCost(HashTable& hashTable, const char* country) {
-    BST* tree = hashTable.getTree(country);
-    if (tree) {
-        int count = 0, capacity = 10;
-        Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-        if (!parcels) {
-            printf("\n");
-            printf("Memory allocation failed.\n");
-            return;
-        }
-        tree->inorder(parcels, count, capacity);
-
-        if (count == 0) {
-            printf("\n");
-            printf("No parcels found for country %s\n", country);
-            free(parcels);
-            return;
-        }
-
-        Parcel* cheapest = parcels[0];
-        Parcel* mostExpensive = parcels[0];
-        for (int i = 1; i < count; i++) {
-            if (parcels[i]->valuation < cheapest->valuation) {
-                cheapest = parcels[i];
-            }
-            if (parcels[i]->valuation > mostExpensive->valuation) {
-                mostExpensive = parcels[i];
-            }
-        }
-        printf("\n");
-        printf("Cheapest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, cheapest->country, cheapest->weight, cheapest->valuation);
-        printf("\n");
-        printf("Most expensive parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, mostExpensive->country, mostExpensive->weight, mostExpensive->valuation);
-
-        free(parcels);
-    }
-    else {
-        printf("\n");
-        printf("No parcels found for country %s\n", country);
-    }
-}
-
-/*
- * FUNCTION    : lightestAndHeaviest
- * DESCRIPTION : Displays the details of the lightest and heaviest parcels for
- *               a given country by evaluating all parcels stored in the
- *               associated binary search tree.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* country  - The name of the country to look up.
- */
-void lightestAndHeaviest(HashTable& hashTable, const char* country) {
-    BST* tree = hashTable.getTree(country);
-    if (tree) {
-        int count = 0, capacity = 10;
-        Parcel** parcels = (Parcel**)malloc(capacity * sizeof(Parcel*));
-        if (!parcels) {
-            printf("Memory allocation failed.\n");
-            return;
-        }
-        tree->inorder(parcels, count, capacity);
-
-        if (count == 0) {
-            printf("\n");
-            printf("No parcels found for country %s\n", country);
-            free(parcels);
-            return;
-        }
-
-        Parcel* lightest = parcels[0];
-        Parcel* heaviest = parcels[0];
-        for (int i = 1; i < count; i++) {
-            if (parcels[i]->weight < lightest->weight) {
-                lightest = parcels[i];
-            }
-            if (parcels[i]->weight > heaviest->weight) {
-                heaviest = parcels[i];
-            }
-        }
-        printf("\n");
-        printf("Lightest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, lightest->country, lightest->weight, lightest->valuation);
-        printf("\n");
-        printf("Heaviest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, heaviest->country, heaviest->weight, heaviest->valuation);
-
-        free(parcels);
-    }
-    else {
-        printf("\n");
-        printf("No parcels found for country %s\n", country);
-    }
-}
-
-/*
- * FUNCTION    : readFile
- * DESCRIPTION : Reads parcel data from a file and inserts each parcel into
- *               the hash table. The file should contain country, weight, and
- *               valuation data for each parcel.
- * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
- *               const char* filename - The name of the file to read from.
- */
-void readFile(HashTable& hashTable, const char* filename) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        printf("Failed to open file %s\n", filename);
-        return;
-    }
-    char country[MAX_COUNTRY_NAME_LENGTH];
-    int weight;
-    float valuation;
-    while (file >> country >> weight >> valuation) {
-        Parcel* parcel = new Parcel(country, weight, valuation);
-        hashTable.insert(parcel);
-    }
-    file.close();
-}
-
-
-/*
- * FUNCTION    : getUserInput
- * DESCRIPTION : Prompts the user for input and stores the result in a buffer.
- *               The function also removes any trailing newline characters from
- *               the input string.
- * PARAMETERS  : const char* prompt - The prompt message to display to the user.
- *               char* buffer       - The buffer to store the user's input.
- *               int size           - The size of the buffer.
- */
-void getUserInput(const char* prompt, char* buffer, int size) {
-    // Function implementation here for getUserInput
-    printf("%s", prompt);
-    fgets(buffer, size, stdin);
-    size_t length = strlen(buffer);
-    if (length > 0 && buffer[length - 1] == '\n') {
-        buffer[length - 1] = '\0';
-    }
-}
+/*
+* File          :  project.cpp
+* Project       :  Parcel Management System Using Hash Table and Binary Search Tree.
+* Programmer    :  Prit Patel (8979395)
+                           : Vruti Mistry (8963142)
+* First version : 2024-08-07
+* Description   : This program handles parcel data for delivery service, saving and
+*                 retrieving parcels based on destination country. This hash
+*                 table mapping country names maps them to binary search trees which
+*                 organize parcels by weight. Each tree is a B+tree, so it stays balanced
+*                 and can be walked leaf by leaf without recursion.
+*                 The system supports the following operations: displaying of all parcels
+*                 for a country, filtering parcels by weight, calculation of the total load
+*                 and valuation for a country, and identifying the cheapest, most expensive,
+*                 lightest, and heaviest parcels.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+// Pick the widest vector instructions the compiler is allowed to use for the column kernels
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define COLUMN_KERNELS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLUMN_KERNELS_SSE2
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#pragma warning(disable: 4996)
+#define HASH_TABLE_FIRST_SIZE 64          // Initial number of slots in the hash table of countries
+#define MAX_COUNTRY_NAME_LENGTH 255        // Longest country name accepted from the manifest or the menu
+#define MIN_LOAD_CHUNK_SIZE (1 << 20)      // Smallest piece of the manifest handed to a loader thread
+#define MAX_REPORTED_MALFORMED_LINES 5     // Malformed lines listed by number after a load
+#define SLAB_FIRST_CAPACITY 16             // Objects in the first slab of a pool
+#define SLAB_MAX_BYTES (1 << 20)           // Slabs stop doubling once they reach this size
+#define COUNTRY_NAME_BLOCK_SIZE 4096       // Bytes in each block of interned country names
+#define COUNTRY_LOOKUP_FIRST_SIZE 64       // Initial number of slots in the country dictionary
+#define OPEN_TABLE_MAX_LOAD_PERCENT 80     // Open-addressing tables double once this full
+#define COLUMN_BENCHMARK_REPEATS 20        // Times each query is repeated per country by --bench-columns
+#define SNAPSHOT_MAGIC "PRCLSNAP"          // First eight bytes of every snapshot file
+#define SNAPSHOT_VERSION 3                 // Bumped whenever the snapshot layout changes
+#define SNAPSHOT_BUFFER_SIZE (1 << 20)     // Bytes buffered by the snapshot writer between writes
+#define SNAPSHOT_CHECKSUM_SEED 14695981039346656037ULL  // Starting value of the snapshot checksum
+#define BATCH_BUFFER_SIZE (1 << 20)        // Bytes of batch results buffered between writes
+#define STRESS_READER_THREADS 4            // Reader threads started by --stress
+#define STRESS_INSERTS 1000000             // Parcels inserted by the --stress writer
+#define STRESS_NEW_COUNTRY_INTERVAL 100000 // Inserts between new countries added by the --stress writer
+#define STRESS_REMOVE_INTERVAL 4           // Inserts between removals of an earlier insert by the --stress writer
+#define STRESS_UPDATE_INTERVAL 5           // Inserts between updates of an earlier insert by the --stress writer
+#define STRESS_IDLE_MILLISECONDS 500       // Time the --stress readers run before the writer starts
+#define STRESS_CHECK_INTERVAL 16           // Queries between full consistency checks by a --stress reader
+#define FOLLOW_POLL_MILLISECONDS 50        // Longest wait between checks of the manifest in --follow mode
+#define FOLLOW_READ_SIZE (1 << 20)         // Bytes read at a time from the end of a followed manifest
+#define SERVER_MAX_IN_FLIGHT 1024          // Requests a server connection may have outstanding before no more of its lines are run
+#define SERVER_MAX_OUTPUT (4 << 20)        // Response bytes a server connection may hold, unsent or reserved for running lines
+#define SERVER_MAX_ROWS 10000              // Parcel rows in one server response; the rest are cut off
+#define SERVER_ROW_OVERHEAD 192            // Most bytes in a server response row besides its command and country
+#define SERVER_MAX_CONNECTIONS 256         // Open connections beyond which the server refuses new ones
+#define SERVER_READ_SIZE 65536             // Bytes read from a socket at a time, and of unrun input a connection may buffer
+#define SERVER_MAX_EVENTS 64               // Events taken from epoll per wait
+#define LOADGEN_CONNECTIONS 4              // Connections opened by --loadgen unless --connections says otherwise
+#define LOADGEN_PIPELINE 16                // Requests --loadgen keeps in flight per connection unless --pipeline says otherwise
+#define LOADGEN_REQUESTS 100000            // Requests sent by --loadgen unless --requests says otherwise
+#define SHARD_INDEX_NAME "index.txt"       // Index file of a partitioned manifest, listing where each country's parcels are
+#define SHARD_INDEX_MAGIC "PRCLSHARDS"     // First word of every shard index
+#define SHARD_INDEX_VERSION 2              // Bumped whenever the shard layout changes
+#define SHARD_FILE_FORMAT "shard-%lld-%05d.bin" // Name of each shard file of a partitioned manifest, by generation and number
+#define LAZY_MEMORY_BUDGET_MB 256          // Megabytes of trees --lazy keeps loaded unless --memory-budget says otherwise
+#define CENTS_PER_UNIT 100                 // Valuations are held in whole cents
+#define GENERATE_MAX_WEIGHT 50000          // Heaviest parcel written by --generate
+#define GENERATE_MAX_ROWS 1e9              // Most rows --generate will write
+#define GENERATE_MAX_COUNTRIES 9999        // Most countries --generate will spread parcels over
+#define GENERATE_BUFFER_SIZE (1 << 20)     // Bytes buffered by --generate between writes
+#define BENCHMARK_QUERIES 10000            // Most queries of each type timed by --benchmark
+#define BENCHMARK_SECONDS 1.0              // Longest time spent on each query type by --benchmark
+#define BENCHMARK_SEED 2024                // Seed of the random queries run by --benchmark
+#define BENCHMARK_TOP_K 10                 // K used by the top-K queries timed by --benchmark
+#define REPORT_COUNTRIES_PER_THREAD 1024  // Fewest countries given to each thread of a fleet report
+#define STATS_HISTOGRAM_BUCKETS 480        // Buckets in each latency histogram: 8 per power of two up to about 2^61 ns
+
+#ifndef _MSC_VER
+// The bounds-checked sscanf_s from the Microsoft runtime is not available on other
+// compilers; for the "%d" conversions made here it behaves exactly like sscanf
+#define sscanf_s sscanf
+#endif
+
+using namespace std;
+
+// Define a struct for a reader-writer lock that lets a waiting writer in ahead of new readers
+// std::shared_mutex prefers readers on glibc, so a steady stream of queries could hold off
+// an insert for good. It has the same members as shared_mutex, so shared_lock and unique_lock
+// work with it unchanged. Readers must not take it again while they already hold it.
+struct ReadWriteLock {
+#ifdef _WIN32
+    SRWLOCK handle;     // Slim reader-writer lock, which does not favour readers
+    ReadWriteLock() {
+        InitializeSRWLock(&handle);
+    }
+    void lock() {
+        AcquireSRWLockExclusive(&handle);
+    }
+    bool try_lock() {
+        return TryAcquireSRWLockExclusive(&handle) != 0;
+    }
+    void unlock() {
+        ReleaseSRWLockExclusive(&handle);
+    }
+    void lock_shared() {
+        AcquireSRWLockShared(&handle);
+    }
+    void unlock_shared() {
+        ReleaseSRWLockShared(&handle);
+    }
+#else
+    pthread_rwlock_t handle;    // POSIX reader-writer lock, set to prefer writers where supported
+    ReadWriteLock() {
+        pthread_rwlockattr_t attributes;
+        pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&handle, &attributes);
+        pthread_rwlockattr_destroy(&attributes);
+    }
+    ~ReadWriteLock() {
+        pthread_rwlock_destroy(&handle);
+    }
+    void lock() {
+        pthread_rwlock_wrlock(&handle);
+    }
+    bool try_lock() {
+        return pthread_rwlock_trywrlock(&handle) == 0;
+    }
+    void unlock() {
+        pthread_rwlock_unlock(&handle);
+    }
+    void lock_shared() {
+        pthread_rwlock_rdlock(&handle);
+    }
+    void unlock_shared() {
+        pthread_rwlock_unlock(&handle);
+    }
+#endif
+    ReadWriteLock(const ReadWriteLock&) = delete;
+    ReadWriteLock& operator=(const ReadWriteLock&) = delete;
+};
+
+// Define a template for an open-addressing table of values keyed on a 32-bit hash, using Robin Hood probing
+// Each slot holds the hash and the value inline, so a probe compares hashes without leaving
+// the slot array, and a lookup usually touches one cache line. An insert that meets a slot
+// whose value sits closer to its home slot than the one being placed takes that slot over,
+// which keeps every value within a few slots of home. Values are only ever added, and the
+// table doubles when it gets too full. It does no locking of its own.
+template <typename T>
+struct OpenTable {
+    // Define a struct for one slot of the table
+    struct Slot {
+        uint32_t hash;      // Hash of the value's key
+        uint32_t distance;  // One more than the number of slots past home, or 0 when the slot is empty
+        T value;            // The value
+    };
+    vector<Slot> slots;     // The slots; their number is always a power of two
+    size_t used;            // Slots holding a value
+
+    OpenTable(size_t capacity) : slots(capacity, Slot()), used(0) {}
+    // Function to find a value by hash; 'matches' checks a candidate's full key and is only
+    // called on values whose hash is equal. Returns nullptr if there is no such value.
+    template <typename Match>
+    const T* find(uint32_t hash, Match matches) const {
+        size_t mask = slots.size() - 1;
+        for (uint32_t distance = 1;; distance++) {
+            const Slot& slot = slots[(hash + distance - 1) & mask];
+            // An empty slot, or one closer to home than this, means the value would have been placed before it
+            if (slot.distance < distance) {
+                return nullptr;
+            }
+            if (slot.hash == hash && matches(slot.value)) {
+                return &slot.value;
+            }
+        }
+    }
+    // Function to add a value whose key is not in the table yet
+    void insert(uint32_t hash, const T& value) {
+        if ((used + 1) * 100 > slots.size() * OPEN_TABLE_MAX_LOAD_PERCENT) {
+            grow();
+        }
+        place(hash, value);
+        used++;
+    }
+    // Helper function to put a value in its slot, moving richer values along to make room
+    void place(uint32_t hash, const T& value) {
+        size_t mask = slots.size() - 1;
+        Slot incoming = { hash, 1, value };
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            if (slots[i].distance == 0) {
+                slots[i] = incoming;
+                return;
+            }
+            if (slots[i].distance < incoming.distance) {
+                swap(slots[i], incoming);
+            }
+            incoming.distance++;
+        }
+    }
+    // Helper function to double the number of slots and place every value again
+    void grow() {
+        vector<Slot> old(slots.size() * 2, Slot());
+        old.swap(slots);
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i].distance > 0) {
+                place(old[i].hash, old[i].value);
+            }
+        }
+    }
+    // Function to return the longest distance of any value from its home slot
+    uint32_t longestProbe() const {
+        uint32_t longest = 0;
+        for (size_t i = 0; i < slots.size(); i++) {
+            longest = slots[i].distance > longest ? slots[i].distance : longest;
+        }
+        return longest;
+    }
+};
+
+// Define a struct for the dictionary of every country name the program has seen
+// Each distinct name is stored once and identified by a small integer ID, so parcels
+// and the hash table can refer to countries without copying or comparing strings
+struct CountryDictionary {
+    vector<const char*> names;      // Name of each country, indexed by ID
+    vector<int> lengths;            // Length of each name, indexed by ID
+    OpenTable<int> lookup;          // ID of each name, keyed on the low 32 bits of its hash
+    vector<char*> blocks;           // Storage blocks holding the names
+    char* cursor;                   // Next free byte in the newest block
+    size_t remaining;               // Free bytes left in the newest block
+    size_t reservedBytes;           // Bytes obtained from malloc for the blocks
+    mutable ReadWriteLock lock;     // Held shared by lookups, exclusively while a name is added
+
+    CountryDictionary() : lookup(COUNTRY_LOOKUP_FIRST_SIZE), cursor(nullptr), remaining(0), reservedBytes(0) {}
+    CountryDictionary(const CountryDictionary&) = delete;
+    CountryDictionary& operator=(const CountryDictionary&) = delete;
+    // Hash function to compute the hash value of a country name
+    // The name is taken eight bytes at a time, each word mixed in with a multiply and a rotate,
+    // and the result goes through a final avalanche so the low bits used for slots are well spread
+    static uint64_t hashFunction(const char* str, size_t length) {
+        uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (length * 0xFF51AFD7ED558CCDULL);
+        while (length > 0) {
+            uint64_t word = 0;
+            size_t bytes = length < 8 ? length : 8;
+            memcpy(&word, str, bytes);
+            hash ^= word * 0xBF58476D1CE4E5B9ULL;
+            hash = ((hash << 27) | (hash >> 37)) * 0x94D049BB133111EBULL;
+            str += bytes;
+            length -= bytes;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+    // Function to look up the ID of a country name; returns -1 if the name has never been interned
+    int find(const char* name, size_t length) const {
+        shared_lock<ReadWriteLock> guard(lock);
+        return findUnlocked(name, length);
+    }
+    // Helper function for find, called with the lock already held
+    int findUnlocked(const char* name, size_t length) const {
+        const int* id = lookup.find((uint32_t)hashFunction(name, length), [&](int candidate) {
+            return lengths[candidate] == (int)length && memcmp(names[candidate], name, length) == 0;
+        });
+        return id ? *id : -1;
+    }
+    // Function to look up the ID of a null-terminated country name
+    int find(const char* name) const {
+        return find(name, strlen(name));
+    }
+    // Function to return the ID of a country name, adding the name to the dictionary if it is new
+    int intern(const char* name, size_t length) {
+        int id = find(name, length);
+        if (id >= 0) {
+            return id;
+        }
+        // Check again under the exclusive lock, as another thread may have added the name in between
+        unique_lock<ReadWriteLock> guard(lock);
+        id = findUnlocked(name, length);
+        if (id >= 0) {
+            return id;
+        }
+        id = (int)names.size();
+        names.push_back(storeName(name, length));
+        lengths.push_back((int)length);
+        lookup.insert((uint32_t)hashFunction(name, length), id);
+        return id;
+    }
+    // Function to return the name of a country ID
+    // The name itself never moves, so the pointer stays valid after the lock is released
+    const char* name(int id) const {
+        shared_lock<ReadWriteLock> guard(lock);
+        return names[id];
+    }
+    // Function to return the number of IDs handed out so far
+    int count() const {
+        shared_lock<ReadWriteLock> guard(lock);
+        return (int)names.size();
+    }
+    // Helper function to copy a name into the block storage, null terminated
+    const char* storeName(const char* name, size_t length) {
+        if (remaining < length + 1) {
+            size_t size = length + 1 > COUNTRY_NAME_BLOCK_SIZE ? length + 1 : COUNTRY_NAME_BLOCK_SIZE;
+            cursor = (char*)malloc(size);
+            if (!cursor) {
+                throw bad_alloc();
+            }
+            blocks.push_back(cursor);
+            remaining = size;
+            reservedBytes += size;
+        }
+        char* stored = cursor;
+        memcpy(stored, name, length);
+        stored[length] = '\0';
+        cursor += length + 1;
+        remaining -= length + 1;
+        return stored;
+    }
+    // Destructor to free every block of names
+    ~CountryDictionary() {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            free(blocks[i]);
+        }
+    }
+};
+
+// The one dictionary shared by the loader, the index and the queries
+CountryDictionary countryDictionary;
+
+// Define a struct to represent a parcel
+// The destination is stored as an ID from countryDictionary rather than a copy of the name
+// The valuation is held in whole cents, so totals and comparisons are exact integer operations.
+// Valuations given with more than two decimals are rounded to the nearest cent, halves away from
+// zero, when they are read; so 1.005 is 1.01 and 2.675 is 2.68 wherever they are printed.
+struct Parcel {
+    int countryId;      // ID of the destination country in countryDictionary
+    int weight;         // Weight of the parcel
+    int64_t valuation;  // Valuation of the parcel, in cents
+    // Constructor to initialize a Parcel object with the country ID, weight, and valuation
+    Parcel(int c, int w, int64_t v) : countryId(c), weight(w), valuation(v) {}
+};
+
+// Converts a valuation in cents to a number for printing with "%.2f"
+// Up to 2^53 cents (about 90 trillion), the double nearest to the amount prints exactly as it
+static inline double centsToAmount(int64_t cents) {
+    return (double)cents / CENTS_PER_UNIT;
+}
+
+// Define a template for a pool that hands out objects of one type from large slabs
+// Objects are carved off the newest slab one after another, released objects are kept
+// on a free list for reuse, and destroying the pool frees every slab at once without
+// visiting the objects, which is why only trivially destructible types are allowed
+template <typename T>
+struct SlabPool {
+    static_assert(is_trivially_destructible<T>::value, "SlabPool frees objects without destroying them");
+    static_assert(sizeof(T) >= sizeof(void*), "SlabPool links free objects through their storage");
+
+    // Define a struct for the header at the start of every slab
+    struct Slab {
+        Slab* next;     // Previously allocated slab
+    };
+
+    Slab* slabs;            // Most recently allocated slab
+    char* cursor;           // Next unused object in the newest slab
+    size_t remaining;       // Unused objects left in the newest slab
+    size_t nextCapacity;    // Number of objects to put in the next slab
+    void* freeList;         // Released objects waiting to be reused
+    size_t live;            // Objects currently handed out
+    size_t reservedBytes;   // Bytes obtained from malloc for all slabs
+
+    SlabPool() : slabs(nullptr), cursor(nullptr), remaining(0), nextCapacity(SLAB_FIRST_CAPACITY),
+        freeList(nullptr), live(0), reservedBytes(0) {}
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+    // Function to get storage for one object; construct it with placement new
+    void* allocate() {
+        live++;
+        if (freeList) {
+            void* object = freeList;
+            memcpy(&freeList, object, sizeof(void*));  // Objects such as Parcel may be less aligned than a pointer
+            return object;
+        }
+        if (remaining == 0) {
+            grow();
+        }
+        void* object = cursor;
+        cursor += sizeof(T);
+        remaining--;
+        return object;
+    }
+    // Function to hand an object back to the pool so its storage can be reused
+    void release(T* object) {
+        object->~T();
+        memcpy((void*)object, &freeList, sizeof(void*));
+        freeList = object;
+        live--;
+    }
+    // Helper function to allocate a new slab, twice the size of the previous one up to SLAB_MAX_BYTES
+    void grow() {
+        size_t offset = (sizeof(Slab) + alignof(T) - 1) / alignof(T) * alignof(T);
+        size_t bytes = offset + nextCapacity * sizeof(T);
+        Slab* slab = (Slab*)malloc(bytes);
+        if (!slab) {
+            throw bad_alloc();
+        }
+        slab->next = slabs;
+        slabs = slab;
+        cursor = (char*)slab + offset;
+        remaining = nextCapacity;
+        reservedBytes += bytes;
+        if (nextCapacity * sizeof(T) < SLAB_MAX_BYTES) {
+            nextCapacity *= 2;
+        }
+    }
+    // Function to free every slab and start over empty; any objects still handed out are gone with them
+    void clear() {
+        while (slabs) {
+            Slab* next = slabs->next;
+            free(slabs);
+            slabs = next;
+        }
+        cursor = nullptr;
+        remaining = 0;
+        nextCapacity = SLAB_FIRST_CAPACITY;
+        freeList = nullptr;
+        live = 0;
+        reservedBytes = 0;
+    }
+    // Destructor to free every slab in one pass over the slab list
+    ~SlabPool() {
+        clear();
+    }
+};
+
+// Define a struct for the memory used by the parcels and nodes of an index
+struct IndexMemory {
+    long long parcels;      // Parcels stored
+    long long leaves;       // Leaf nodes in use
+    long long innerNodes;   // Inner nodes in use
+    long long entries;      // Per-country entries in the hash table
+    size_t reservedBytes;   // Bytes reserved from the heap for all of the above
+    IndexMemory() : parcels(0), leaves(0), innerNodes(0), entries(0), reservedBytes(0) {}
+};
+
+// The BST is a B+tree: parcels live in wide leaf nodes that are linked together in
+// weight order, and inner nodes only hold separator weights for routing. Nodes are
+// sized so a leaf's weights sit in a few cache lines, and the tree stays balanced no
+// matter what order the parcels arrive in.
+#define BST_LEAF_CAPACITY 32     // Maximum number of parcels stored in a leaf node
+#define BST_INNER_CAPACITY 32    // Maximum number of separator keys in an inner node
+#define BST_MAX_HEIGHT 32        // Upper bound on tree height, far above anything reachable
+#define BST_LEAF_MINIMUM (BST_LEAF_CAPACITY / 2)     // Fewest parcels a removal leaves in a leaf before rebalancing it
+#define BST_INNER_MINIMUM (BST_INNER_CAPACITY / 2)   // Fewest separator keys a removal leaves in an inner node before rebalancing it
+
+// Define a struct for the running totals of a group of parcels
+// Every BST node keeps one for its whole subtree, so totals never need a scan
+struct ParcelSummary {
+    int count;                  // Number of parcels
+    long long totalWeight;      // Sum of the parcels' weights
+    int64_t totalValuation;     // Sum of the parcels' valuations, in cents
+    Parcel* cheapest;           // Parcel with the lowest valuation, nullptr when empty
+    Parcel* mostExpensive;      // Parcel with the highest valuation, nullptr when empty
+    ParcelSummary() {
+        clear();
+    }
+    // Function to reset the summary to an empty group
+    void clear() {
+        count = 0;
+        totalWeight = 0;
+        totalValuation = 0;
+        cheapest = nullptr;
+        mostExpensive = nullptr;
+    }
+    // Function to add one parcel to the summary
+    // Ties on valuation go to the lighter parcel, which is the one an inorder scan meets first
+    void add(Parcel* parcel) {
+        count++;
+        totalWeight += parcel->weight;
+        totalValuation += parcel->valuation;
+        if (!cheapest || parcel->valuation < cheapest->valuation ||
+            (parcel->valuation == cheapest->valuation && parcel->weight < cheapest->weight)) {
+            cheapest = parcel;
+        }
+        if (!mostExpensive || parcel->valuation > mostExpensive->valuation ||
+            (parcel->valuation == mostExpensive->valuation && parcel->weight < mostExpensive->weight)) {
+            mostExpensive = parcel;
+        }
+    }
+    // Function to take one parcel of the group out of the summary
+    // Returns false if it was the cheapest or most expensive, in which case the summary must be
+    // rebuilt from the parcels that are left
+    bool remove(const Parcel* parcel) {
+        count--;
+        totalWeight -= parcel->weight;
+        totalValuation -= parcel->valuation;
+        return parcel != cheapest && parcel != mostExpensive;
+    }
+    // Function to account for a parcel of the group whose valuation has changed from 'oldValuation'
+    // Returns false if the summary must be rebuilt: when the parcel was the cheapest or most
+    // expensive, or now ties with one of them, since ties go to the earlier parcel
+    bool revalue(Parcel* parcel, int64_t oldValuation) {
+        totalValuation += parcel->valuation - oldValuation;
+        if (parcel == cheapest || parcel == mostExpensive ||
+            parcel->valuation == cheapest->valuation || parcel->valuation == mostExpensive->valuation) {
+            return false;
+        }
+        if (parcel->valuation < cheapest->valuation) {
+            cheapest = parcel;
+        }
+        if (parcel->valuation > mostExpensive->valuation) {
+            mostExpensive = parcel;
+        }
+        return true;
+    }
+    // Function to fold in the summary of parcels that all come after this group in weight order
+    void merge(const ParcelSummary& other) {
+        if (other.count == 0) {
+            return;
+        }
+        count += other.count;
+        totalWeight += other.totalWeight;
+        totalValuation += other.totalValuation;
+        if (!cheapest || other.cheapest->valuation < cheapest->valuation) {
+            cheapest = other.cheapest;
+        }
+        if (!mostExpensive || other.mostExpensive->valuation > mostExpensive->valuation) {
+            mostExpensive = other.mostExpensive;
+        }
+    }
+};
+
+// Define a struct for the fields shared by every node in the BST
+struct BSTNode {
+    bool isLeaf;            // True for leaf nodes, false for inner nodes
+    int count;              // Number of parcels (leaf) or separator keys (inner) in use
+    ParcelSummary summary;  // Totals for every parcel below this node
+    BSTNode(bool leaf) : isLeaf(leaf), count(0) {}
+};
+
+// Define a struct to represent a leaf node of the BST
+// Weights are kept in their own array so searching a leaf scans contiguous memory
+struct BSTDataNode : BSTNode {
+    int weights[BST_LEAF_CAPACITY];         // Sorted weights of the parcels in this leaf
+    Parcel* parcels[BST_LEAF_CAPACITY];     // Parcels, in the same order as weights
+    BSTDataNode* prev;                      // Previous leaf in weight order
+    BSTDataNode* next;                      // Next leaf in weight order
+    BSTDataNode() : BSTNode(true), prev(nullptr), next(nullptr) {}
+};
+
+// Define a struct for a position among a tree's parcels that steps forwards or backwards in weight order
+// It points straight into the leaves, so walking with it allocates nothing. It is only valid while
+// the tree is unchanged, which holding a TreeReader guarantees.
+struct ParcelCursor {
+    BSTDataNode* leaf;  // Leaf holding the current parcel, or nullptr once the cursor has run off either end
+    int index;          // Position of the current parcel within the leaf
+    ParcelCursor(BSTDataNode* l = nullptr, int i = 0) : leaf(l), index(i) {}
+    // Function to check whether the cursor is on a parcel
+    explicit operator bool() const {
+        return leaf != nullptr;
+    }
+    // Function to return the parcel under the cursor
+    Parcel* parcel() const {
+        return leaf->parcels[index];
+    }
+    // Function to return the weight of the parcel under the cursor, read from the leaf
+    int weight() const {
+        return leaf->weights[index];
+    }
+    // Function to step to the next parcel, which weighs the same or more
+    void next() {
+        if (++index == leaf->count) {
+            leaf = leaf->next;
+            index = 0;
+        }
+    }
+    // Function to step to the previous parcel, which weighs the same or less
+    void previous() {
+        if (--index < 0) {
+            leaf = leaf->prev;
+            index = leaf ? leaf->count - 1 : 0;
+        }
+    }
+};
+
+// Define a struct to represent an inner node of the BST
+// children[i] holds the parcels weighing between keys[i - 1] and keys[i]
+struct BSTInnerNode : BSTNode {
+    int keys[BST_INNER_CAPACITY];               // Separator weights
+    BSTNode* children[BST_INNER_CAPACITY + 1];  // Child subtrees
+    BSTInnerNode() : BSTNode(false) {}
+};
+
+// Returns the index of the first weight in a sorted array that is greater than 'weight'
+static int upperBound(const int* weights, int count, int weight) {
+    int low = 0, high = count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (weights[mid] <= weight) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Returns the index of the first weight in a sorted array that is not less than 'weight'
+static int lowerBound(const int* weights, int count, int weight) {
+    int low = 0, high = count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (weights[mid] < weight) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Returns the first parcel, in weight order, below 'node' that weighs at least 'weight'; there must be one
+static Parcel* firstParcelFrom(const BSTNode* node, int weight) {
+    while (!node->isLeaf) {
+        const BSTInnerNode* inner = static_cast<const BSTInnerNode*>(node);
+        node = inner->children[lowerBound(inner->keys, inner->count, weight)];
+    }
+    const BSTDataNode* leaf = static_cast<const BSTDataNode*>(node);
+    int index = lowerBound(leaf->weights, leaf->count, weight);
+    // Separators only bound the children from below, so the parcel may start the next leaf
+    return index < leaf->count ? leaf->parcels[index] : leaf->next->parcels[0];
+}
+
+// Returns the weight of the heaviest parcel below 'node', found by following the last children down
+static int heaviestWeightBelow(const BSTNode* node) {
+    while (!node->isLeaf) {
+        const BSTInnerNode* inner = static_cast<const BSTInnerNode*>(node);
+        node = inner->children[inner->count];
+    }
+    const BSTDataNode* leaf = static_cast<const BSTDataNode*>(node);
+    return leaf->weights[leaf->count - 1];
+}
+
+// Query aggregates fold the parcels of a weight range into one result each, and BST::query runs
+// any set of them together in a single pass. The parcels are always offered in weight order.
+// Every aggregate has add() for one parcel; one whose 'wholeSubtrees' is true also has merge(),
+// which takes every parcel below a node at once from the node's summary
+
+// Define a struct for a query aggregate that keeps the count, total load and total valuation
+struct TotalsAggregate {
+    static constexpr bool wholeSubtrees = true;
+    int count;                  // Number of parcels
+    long long totalWeight;      // Sum of the parcels' weights
+    int64_t totalValuation;     // Sum of the parcels' valuations, in cents
+    TotalsAggregate() : count(0), totalWeight(0), totalValuation(0) {}
+    void add(const Parcel* parcel) {
+        count++;
+        totalWeight += parcel->weight;
+        totalValuation += parcel->valuation;
+    }
+    void merge(const BSTNode* node) {
+        count += node->summary.count;
+        totalWeight += node->summary.totalWeight;
+        totalValuation += node->summary.totalValuation;
+    }
+};
+
+// Define a struct for a query aggregate that finds the cheapest parcel; ties go to the lighter one
+struct CheapestAggregate {
+    static constexpr bool wholeSubtrees = true;
+    Parcel* cheapest;           // Cheapest parcel so far, nullptr until one is seen
+    CheapestAggregate() : cheapest(nullptr) {}
+    void add(Parcel* parcel) {
+        if (!cheapest || parcel->valuation < cheapest->valuation) {
+            cheapest = parcel;
+        }
+    }
+    void merge(const BSTNode* node) {
+        add(node->summary.cheapest);
+    }
+};
+
+// Define a struct for a query aggregate that finds the most expensive parcel; ties go to the lighter one
+struct MostExpensiveAggregate {
+    static constexpr bool wholeSubtrees = true;
+    Parcel* mostExpensive;      // Most expensive parcel so far, nullptr until one is seen
+    MostExpensiveAggregate() : mostExpensive(nullptr) {}
+    void add(Parcel* parcel) {
+        if (!mostExpensive || parcel->valuation > mostExpensive->valuation) {
+            mostExpensive = parcel;
+        }
+    }
+    void merge(const BSTNode* node) {
+        add(node->summary.mostExpensive);
+    }
+};
+
+// Define a struct for a query aggregate that finds the lightest parcel, the first one offered
+struct LightestAggregate {
+    static constexpr bool wholeSubtrees = true;
+    Parcel* lightest;           // Lightest parcel so far, nullptr until one is seen
+    LightestAggregate() : lightest(nullptr) {}
+    void add(Parcel* parcel) {
+        if (!lightest) {
+            lightest = parcel;
+        }
+    }
+    void merge(const BSTNode* node) {
+        if (!lightest) {
+            lightest = firstParcelFrom(node, INT_MIN);
+        }
+    }
+};
+
+// Define a struct for a query aggregate that finds the heaviest parcel; of several with the
+// largest weight, it keeps the first one
+struct HeaviestAggregate {
+    static constexpr bool wholeSubtrees = true;
+    Parcel* heaviest;           // Heaviest parcel so far, nullptr until one is seen
+    HeaviestAggregate() : heaviest(nullptr) {}
+    void add(Parcel* parcel) {
+        if (!heaviest || parcel->weight > heaviest->weight) {
+            heaviest = parcel;
+        }
+    }
+    void merge(const BSTNode* node) {
+        // Parcels offered earlier are no heavier than any below this node, so only a heavier
+        // maximum changes the answer, and its first parcel lies below this node too
+        int weight = heaviestWeightBelow(node);
+        if (!heaviest || weight > heaviest->weight) {
+            heaviest = firstParcelFrom(node, weight);
+        }
+    }
+};
+
+// Define a struct for a query aggregate that hands every parcel to a visitor, such as one that prints it
+// A query that includes it visits each parcel in the range once. As with forEach, the visitor
+// returns false to stop early, which ends the whole query's walk.
+template <typename Visitor>
+struct VisitAggregate {
+    static constexpr bool wholeSubtrees = false;
+    Visitor visitor;            // Called with each parcel
+    int visited;                // Number of parcels visited
+    VisitAggregate(Visitor v) : visitor(v), visited(0) {}
+    bool add(Parcel* parcel) {
+        visited++;
+        return visitor(parcel);
+    }
+};
+
+// Function to hand a parcel to a query aggregate; returns false if the aggregate asks the query to stop
+// Only visitors can ask that, so for the other aggregates it is always true
+template <typename Aggregate>
+inline bool offerParcel(Aggregate& aggregate, Parcel* parcel) {
+    if constexpr (is_same<decltype(aggregate.add(parcel)), bool>::value) {
+        return aggregate.add(parcel);
+    }
+    else {
+        aggregate.add(parcel);
+        return true;
+    }
+}
+
+// Define a struct for a Binary Search Tree
+// The BST is used to store and manage Parcel objects based on their weight
+struct BST {
+    BSTNode* root;          // Root node of the BST
+    BSTDataNode* head;      // Leaf holding the lightest parcels
+    BSTDataNode* tail;      // Leaf holding the heaviest parcels
+    int height;             // Number of levels, 0 when the tree is empty
+    long long version;      // Incremented by every change, so copies of the tree can tell they are stale
+    SlabPool<Parcel> parcelPool;        // Storage for this tree's parcels
+    SlabPool<BSTDataNode> leafPool;     // Storage for this tree's leaf nodes
+    SlabPool<BSTInnerNode> innerPool;   // Storage for this tree's inner nodes
+    // Constructor to initialize an empty BST
+    BST() : root(nullptr), head(nullptr), tail(nullptr), height(0), version(0) {}
+    // Function to create a parcel in the tree's pool and insert it into the BST based on its weight
+    // Parcels with equal weights are kept in insertion order
+    Parcel* insert(int countryId, int weight, int64_t valuation) {
+        Parcel* parcel = new (parcelPool.allocate()) Parcel(countryId, weight, valuation);
+        link(parcel);
+        return parcel;
+    }
+    // Helper function to place a parcel from the tree's pool into the BST, after any parcels of equal weight
+    void link(Parcel* parcel) {
+        version++;
+        if (!root) {
+            head = tail = new (leafPool.allocate()) BSTDataNode();
+            root = head;
+            height = 1;
+        }
+
+        // Walk down to the leaf, remembering the path so splits can be pushed upwards
+        BSTInnerNode* path[BST_MAX_HEIGHT];
+        int slots[BST_MAX_HEIGHT];
+        int depth = 0;
+        BSTNode* node = root;
+        while (!node->isLeaf) {
+            BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+            int slot = upperBound(inner->keys, inner->count, parcel->weight);
+            inner->summary.add(parcel);
+            path[depth] = inner;
+            slots[depth] = slot;
+            depth++;
+            node = inner->children[slot];
+        }
+
+        BSTDataNode* leaf = static_cast<BSTDataNode*>(node);
+        int position = upperBound(leaf->weights, leaf->count, parcel->weight);
+        if (leaf->count < BST_LEAF_CAPACITY) {
+            insertIntoLeaf(leaf, position, parcel);
+            leaf->summary.add(parcel);
+            return;
+        }
+
+        // The leaf is full, so split it and carry the new separator up the path
+        BSTNode* newChild = splitLeaf(leaf, position, parcel);
+        int separator = static_cast<BSTDataNode*>(newChild)->weights[0];
+        while (depth > 0) {
+            depth--;
+            BSTInnerNode* inner = path[depth];
+            if (inner->count < BST_INNER_CAPACITY) {
+                insertIntoInner(inner, slots[depth], separator, newChild);
+                return;
+            }
+            newChild = splitInner(inner, slots[depth], separator, newChild, separator);
+        }
+
+        // The root itself was split, so the tree grows by one level
+        BSTInnerNode* newRoot = new (innerPool.allocate()) BSTInnerNode();
+        newRoot->keys[0] = separator;
+        newRoot->children[0] = root;
+        newRoot->children[1] = newChild;
+        newRoot->count = 1;
+        newRoot->summary = root->summary;
+        newRoot->summary.merge(newChild->summary);
+        root = newRoot;
+        height++;
+    }
+    // Function to return a cursor on the lightest parcel, or an empty cursor if the tree is empty
+    ParcelCursor first() {
+        return ParcelCursor(head, 0);
+    }
+    // Function to return a cursor on the heaviest parcel, or an empty cursor if the tree is empty
+    // Of several parcels with the largest weight, this is the last one inserted
+    ParcelCursor last() {
+        return ParcelCursor(tail, tail ? tail->count - 1 : 0);
+    }
+    // Function to find the first parcel weighing at least 'weight' (or more than 'weight'
+    // when 'strict' is true) by descending through the separators
+    // Returns a cursor on it, or an empty cursor if there is none
+    ParcelCursor seek(int weight, bool strict) {
+        if (!root) {
+            return ParcelCursor();
+        }
+        BSTNode* node = root;
+        while (!node->isLeaf) {
+            BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+            int slot = strict ? upperBound(inner->keys, inner->count, weight) : lowerBound(inner->keys, inner->count, weight);
+            node = inner->children[slot];
+        }
+        BSTDataNode* leaf = static_cast<BSTDataNode*>(node);
+        int index = strict ? upperBound(leaf->weights, leaf->count, weight) : lowerBound(leaf->weights, leaf->count, weight);
+        // Every parcel in the leaf may sit below the bound, in which case the match starts the next leaf
+        if (index == leaf->count) {
+            return ParcelCursor(leaf->next, 0);
+        }
+        return ParcelCursor(leaf, index);
+    }
+    // Function to find the last parcel weighing at most 'weight' (or less than 'weight' when
+    // 'strict' is true); it sits just before the first parcel past the bound
+    // Returns a cursor on it, or an empty cursor if there is none
+    ParcelCursor seekBack(int weight, bool strict) {
+        ParcelCursor cursor = seek(weight, !strict);
+        if (!cursor) {
+            return last();
+        }
+        cursor.previous();
+        return cursor;
+    }
+    // Function to call 'visitor' on each parcel weighing between minWeight and maxWeight, lightest
+    // first and in insertion order among equal weights, stopping early once it returns false
+    // Returns the number of parcels visited
+    template <typename Visitor>
+    int forEach(int minWeight, int maxWeight, Visitor visitor) {
+        int visited = 0;
+        if (minWeight > maxWeight) {
+            return 0;
+        }
+        for (ParcelCursor cursor = seek(minWeight, false); cursor && cursor.weight() <= maxWeight; cursor.next()) {
+            visited++;
+            if (!visitor(cursor.parcel())) {
+                break;
+            }
+        }
+        return visited;
+    }
+    // Function to call 'visitor' on the same parcels as forEach, but heaviest first
+    // Returns the number of parcels visited
+    template <typename Visitor>
+    int forEachReverse(int minWeight, int maxWeight, Visitor visitor) {
+        int visited = 0;
+        if (minWeight > maxWeight) {
+            return 0;
+        }
+        for (ParcelCursor cursor = seekBack(maxWeight, false); cursor && cursor.weight() >= minWeight; cursor.previous()) {
+            visited++;
+            if (!visitor(cursor.parcel())) {
+                break;
+            }
+        }
+        return visited;
+    }
+    // Function to remove the first parcel, in weight order, with the given weight and valuation
+    // Its storage goes back to the pool, and a tree left empty frees its slabs altogether.
+    // Returns false if there is no such parcel.
+    bool remove(int weight, int64_t valuation) {
+        Parcel* parcel = unlink(weight, valuation);
+        if (!parcel) {
+            return false;
+        }
+        parcelPool.release(parcel);
+        if (!root) {
+            parcelPool.clear();
+            leafPool.clear();
+            innerPool.clear();
+        }
+        return true;
+    }
+    // Function to change the weight and valuation of the first parcel with the given weight and valuation
+    // A new valuation alone is written in place; a new weight moves the parcel to its new position,
+    // after any parcels that already weigh the same. Returns the parcel, or nullptr if there is none.
+    Parcel* update(int weight, int64_t valuation, int newWeight, int64_t newValuation) {
+        if (newWeight == weight) {
+            Parcel* parcel = root ? revalueBelow(root, weight, valuation, newValuation) : nullptr;
+            if (parcel) {
+                version++;
+            }
+            return parcel;
+        }
+        Parcel* parcel = unlink(weight, valuation);
+        if (parcel) {
+            parcel->weight = newWeight;
+            parcel->valuation = newValuation;
+            link(parcel);
+        }
+        return parcel;
+    }
+    // Helper function to take a matching parcel out of the tree without releasing it
+    // Returns the parcel, or nullptr if there is none
+    Parcel* unlink(int weight, int64_t valuation) {
+        Parcel* parcel = root ? unlinkBelow(root, weight, valuation) : nullptr;
+        if (!parcel) {
+            return nullptr;
+        }
+        version++;
+        // A root left with a single child hands over to it, and an empty root leaf leaves an empty tree
+        if (!root->isLeaf && root->count == 0) {
+            BSTInnerNode* oldRoot = static_cast<BSTInnerNode*>(root);
+            root = oldRoot->children[0];
+            innerPool.release(oldRoot);
+            height--;
+        }
+        else if (root->isLeaf && root->count == 0) {
+            leafPool.release(static_cast<BSTDataNode*>(root));
+            root = head = tail = nullptr;
+            height = 0;
+        }
+        return parcel;
+    }
+    // Helper function for unlink; takes the parcel out of the subtree under 'node', rebalances the
+    // child it came from and updates the summaries on the way back up, rebuilding only those
+    // whose cheapest or most expensive parcel it was
+    // Parcels of equal weight can straddle several children, so each child the weight could be in is tried
+    Parcel* unlinkBelow(BSTNode* node, int weight, int64_t valuation) {
+        if (node->isLeaf) {
+            BSTDataNode* leaf = static_cast<BSTDataNode*>(node);
+            for (int i = lowerBound(leaf->weights, leaf->count, weight); i < leaf->count && leaf->weights[i] == weight; i++) {
+                if (leaf->parcels[i]->valuation == valuation) {
+                    Parcel* parcel = leaf->parcels[i];
+                    removeFromLeaf(leaf, i);
+                    if (!leaf->summary.remove(parcel)) {
+                        summarizeLeaf(leaf);
+                    }
+                    return parcel;
+                }
+            }
+            return nullptr;
+        }
+        BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+        int last = upperBound(inner->keys, inner->count, weight);
+        for (int slot = lowerBound(inner->keys, inner->count, weight); slot <= last; slot++) {
+            Parcel* parcel = unlinkBelow(inner->children[slot], weight, valuation);
+            if (parcel) {
+                // Rebalancing only moves parcels between this node's children, so its own totals still hold
+                rebalance(inner, slot);
+                if (!inner->summary.remove(parcel)) {
+                    summarizeInner(inner);
+                }
+                return parcel;
+            }
+        }
+        return nullptr;
+    }
+    // Helper function to give a matching parcel a new valuation and update the summaries above it
+    // Returns the parcel, or nullptr if there is none
+    Parcel* revalueBelow(BSTNode* node, int weight, int64_t valuation, int64_t newValuation) {
+        if (node->isLeaf) {
+            BSTDataNode* leaf = static_cast<BSTDataNode*>(node);
+            for (int i = lowerBound(leaf->weights, leaf->count, weight); i < leaf->count && leaf->weights[i] == weight; i++) {
+                if (leaf->parcels[i]->valuation == valuation) {
+                    leaf->parcels[i]->valuation = newValuation;
+                    if (!leaf->summary.revalue(leaf->parcels[i], valuation)) {
+                        summarizeLeaf(leaf);
+                    }
+                    return leaf->parcels[i];
+                }
+            }
+            return nullptr;
+        }
+        BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+        int last = upperBound(inner->keys, inner->count, weight);
+        for (int slot = lowerBound(inner->keys, inner->count, weight); slot <= last; slot++) {
+            Parcel* parcel = revalueBelow(inner->children[slot], weight, valuation, newValuation);
+            if (parcel) {
+                if (!inner->summary.revalue(parcel, valuation)) {
+                    summarizeInner(inner);
+                }
+                return parcel;
+            }
+        }
+        return nullptr;
+    }
+    // Helper function to top up a child that a removal has left below its minimum
+    // It borrows an entry from a sibling that can spare one, and is otherwise merged with a sibling;
+    // the two then fit in one node, as neither is above the minimum
+    void rebalance(BSTInnerNode* parent, int slot) {
+        BSTNode* child = parent->children[slot];
+        int minimum = child->isLeaf ? BST_LEAF_MINIMUM : BST_INNER_MINIMUM;
+        if (child->count >= minimum) {
+            return;
+        }
+        BSTNode* left = slot > 0 ? parent->children[slot - 1] : nullptr;
+        BSTNode* right = slot < parent->count ? parent->children[slot + 1] : nullptr;
+        if (left && left->count > minimum) {
+            borrowFromLeft(parent, slot);
+        }
+        else if (right && right->count > minimum) {
+            borrowFromRight(parent, slot);
+        }
+        else if (left) {
+            mergeChildren(parent, slot - 1);
+        }
+        else if (right) {
+            mergeChildren(parent, slot);
+        }
+    }
+    // Helper function to move the last entry of a child's left sibling to the front of the child
+    void borrowFromLeft(BSTInnerNode* parent, int slot) {
+        if (parent->children[slot]->isLeaf) {
+            BSTDataNode* leaf = static_cast<BSTDataNode*>(parent->children[slot]);
+            BSTDataNode* sibling = static_cast<BSTDataNode*>(parent->children[slot - 1]);
+            insertIntoLeaf(leaf, 0, sibling->parcels[sibling->count - 1]);
+            sibling->count--;
+            parent->keys[slot - 1] = leaf->weights[0];
+            summarizeLeaf(leaf);
+            summarizeLeaf(sibling);
+            return;
+        }
+        // The parent's separator comes down into the child and the sibling's last key goes up in its place
+        BSTInnerNode* inner = static_cast<BSTInnerNode*>(parent->children[slot]);
+        BSTInnerNode* sibling = static_cast<BSTInnerNode*>(parent->children[slot - 1]);
+        memmove(&inner->keys[1], &inner->keys[0], inner->count * sizeof(int));
+        memmove(&inner->children[1], &inner->children[0], (inner->count + 1) * sizeof(BSTNode*));
+        inner->keys[0] = parent->keys[slot - 1];
+        inner->children[0] = sibling->children[sibling->count];
+        inner->count++;
+        parent->keys[slot - 1] = sibling->keys[sibling->count - 1];
+        sibling->count--;
+        summarizeInner(inner);
+        summarizeInner(sibling);
+    }
+    // Helper function to move the first entry of a child's right sibling to the end of the child
+    void borrowFromRight(BSTInnerNode* parent, int slot) {
+        if (parent->children[slot]->isLeaf) {
+            BSTDataNode* leaf = static_cast<BSTDataNode*>(parent->children[slot]);
+            BSTDataNode* sibling = static_cast<BSTDataNode*>(parent->children[slot + 1]);
+            insertIntoLeaf(leaf, leaf->count, sibling->parcels[0]);
+            removeFromLeaf(sibling, 0);
+            parent->keys[slot] = sibling->weights[0];
+            summarizeLeaf(leaf);
+            summarizeLeaf(sibling);
+            return;
+        }
+        // The parent's separator comes down into the child and the sibling's first key goes up in its place
+        BSTInnerNode* inner = static_cast<BSTInnerNode*>(parent->children[slot]);
+        BSTInnerNode* sibling = static_cast<BSTInnerNode*>(parent->children[slot + 1]);
+        inner->keys[inner->count] = parent->keys[slot];
+        inner->children[inner->count + 1] = sibling->children[0];
+        inner->count++;
+        parent->keys[slot] = sibling->keys[0];
+        memmove(&sibling->keys[0], &sibling->keys[1], (sibling->count - 1) * sizeof(int));
+        memmove(&sibling->children[0], &sibling->children[1], sibling->count * sizeof(BSTNode*));
+        sibling->count--;
+        summarizeInner(inner);
+        summarizeInner(sibling);
+    }
+    // Helper function to fold child slot + 1 into child slot and release it back to its pool
+    // The caller refreshes the parent's summary
+    void mergeChildren(BSTInnerNode* parent, int slot) {
+        if (parent->children[slot]->isLeaf) {
+            BSTDataNode* left = static_cast<BSTDataNode*>(parent->children[slot]);
+            BSTDataNode* right = static_cast<BSTDataNode*>(parent->children[slot + 1]);
+            memcpy(&left->weights[left->count], right->weights, right->count * sizeof(int));
+            memcpy(&left->parcels[left->count], right->parcels, right->count * sizeof(Parcel*));
+            left->count += right->count;
+            left->next = right->next;
+            if (right->next) {
+                right->next->prev = left;
+            }
+            else {
+                tail = left;
+            }
+            summarizeLeaf(left);
+            leafPool.release(right);
+        }
+        else {
+            // The separator between the two comes down to join their keys
+            BSTInnerNode* left = static_cast<BSTInnerNode*>(parent->children[slot]);
+            BSTInnerNode* right = static_cast<BSTInnerNode*>(parent->children[slot + 1]);
+            left->keys[left->count] = parent->keys[slot];
+            memcpy(&left->keys[left->count + 1], right->keys, right->count * sizeof(int));
+            memcpy(&left->children[left->count + 1], right->children, (right->count + 1) * sizeof(BSTNode*));
+            left->count += right->count + 1;
+            summarizeInner(left);
+            innerPool.release(right);
+        }
+        int moved = parent->count - slot - 1;
+        memmove(&parent->keys[slot], &parent->keys[slot + 1], moved * sizeof(int));
+        memmove(&parent->children[slot + 1], &parent->children[slot + 2], moved * sizeof(BSTNode*));
+        parent->count--;
+    }
+    // Function to find the parcel at position 'rank' in weight order, counting from 0
+    // The subtree counts in the summaries steer a single descent, so no leaves are walked
+    // Returns the leaf holding it and stores its position in 'index', or nullptr if rank is out of range
+    BSTDataNode* select(int rank, int& index) {
+        if (!root || rank < 0 || rank >= root->summary.count) {
+            return nullptr;
+        }
+        BSTNode* node = root;
+        while (!node->isLeaf) {
+            BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+            int slot = 0;
+            while (rank >= inner->children[slot]->summary.count) {
+                rank -= inner->children[slot]->summary.count;
+                slot++;
+            }
+            node = inner->children[slot];
+        }
+        index = rank;
+        return static_cast<BSTDataNode*>(node);
+    }
+    // Function to return the parcel at a weight percentile by the nearest-rank method: the first
+    // parcel, in weight order, that at least 'fraction' of all parcels weigh no more than
+    // Returns nullptr when the tree is empty
+    Parcel* percentile(double fraction) {
+        if (!root) {
+            return nullptr;
+        }
+        int rank = (int)ceil(fraction * root->summary.count) - 1;
+        int index = 0;
+        BSTDataNode* leaf = select(rank > 0 ? rank : 0, index);
+        return leaf->parcels[index];
+    }
+    // Function to collect the k heaviest parcels, heaviest first, by walking back from the heaviest
+    void heaviest(int k, vector<Parcel*>& result) {
+        result.clear();
+        if (k <= 0) {
+            return;
+        }
+        forEachReverse(INT_MIN, INT_MAX, [&](Parcel* parcel) {
+            result.push_back(parcel);
+            return (int)result.size() < k;
+        });
+    }
+    // Function to collect the k cheapest parcels, or the k most expensive when 'highest' is true,
+    // best first; ties go to the lighter parcel
+    // This is a best-first search over the subtree summaries: a node is only opened once the best
+    // parcel below it is the best candidate left, so only the leaves holding the answer are read
+    void topByValuation(int k, bool highest, vector<Parcel*>& result) {
+        result.clear();
+        if (!root || k <= 0) {
+            return;
+        }
+        // Define a struct for a node or parcel waiting in the queue, ranked by the best parcel it offers
+        struct Candidate {
+            int64_t valuation;  // Valuation of the best parcel in the node, or of the parcel
+            int weight;         // Weight of that parcel
+            BSTNode* node;      // Node still to be opened, or nullptr for a parcel
+            Parcel* parcel;     // The parcel itself, when node is nullptr
+        };
+        auto later = [highest](const Candidate& a, const Candidate& b) {
+            if (a.valuation != b.valuation) {
+                return highest ? a.valuation < b.valuation : a.valuation > b.valuation;
+            }
+            return a.weight > b.weight;
+        };
+        priority_queue<Candidate, vector<Candidate>, decltype(later)> queue(later);
+        Parcel* best = highest ? root->summary.mostExpensive : root->summary.cheapest;
+        queue.push(Candidate{ best->valuation, best->weight, root, nullptr });
+        while (!queue.empty() && (int)result.size() < k) {
+            Candidate next = queue.top();
+            queue.pop();
+            if (!next.node) {
+                result.push_back(next.parcel);
+            }
+            else if (next.node->isLeaf) {
+                BSTDataNode* leaf = static_cast<BSTDataNode*>(next.node);
+                for (int i = 0; i < leaf->count; i++) {
+                    queue.push(Candidate{ leaf->parcels[i]->valuation, leaf->weights[i], nullptr, leaf->parcels[i] });
+                }
+            }
+            else {
+                BSTInnerNode* inner = static_cast<BSTInnerNode*>(next.node);
+                for (int i = 0; i <= inner->count; i++) {
+                    BSTNode* child = inner->children[i];
+                    best = highest ? child->summary.mostExpensive : child->summary.cheapest;
+                    queue.push(Candidate{ best->valuation, best->weight, child, nullptr });
+                }
+            }
+        }
+    }
+    // Helper function to place a parcel at 'position' in a leaf that has room for it
+    void insertIntoLeaf(BSTDataNode* leaf, int position, Parcel* parcel) {
+        int moved = leaf->count - position;
+        memmove(&leaf->weights[position + 1], &leaf->weights[position], moved * sizeof(int));
+        memmove(&leaf->parcels[position + 1], &leaf->parcels[position], moved * sizeof(Parcel*));
+        leaf->weights[position] = parcel->weight;
+        leaf->parcels[position] = parcel;
+        leaf->count++;
+    }
+    // Helper function to take the parcel at 'position' out of a leaf
+    void removeFromLeaf(BSTDataNode* leaf, int position) {
+        int moved = leaf->count - position - 1;
+        memmove(&leaf->weights[position], &leaf->weights[position + 1], moved * sizeof(int));
+        memmove(&leaf->parcels[position], &leaf->parcels[position + 1], moved * sizeof(Parcel*));
+        leaf->count--;
+    }
+    // Helper function to place a separator and the child to its right into an inner node
+    void insertIntoInner(BSTInnerNode* inner, int slot, int key, BSTNode* child) {
+        int moved = inner->count - slot;
+        memmove(&inner->keys[slot + 1], &inner->keys[slot], moved * sizeof(int));
+        memmove(&inner->children[slot + 2], &inner->children[slot + 1], moved * sizeof(BSTNode*));
+        inner->keys[slot] = key;
+        inner->children[slot + 1] = child;
+        inner->count++;
+    }
+    // Helper function to split a full leaf while inserting a parcel into it
+    // Returns the new leaf, which is linked in directly after the old one
+    BSTDataNode* splitLeaf(BSTDataNode* leaf, int position, Parcel* parcel) {
+        BSTDataNode* right = new (leafPool.allocate()) BSTDataNode();
+        // Appending to the last leaf is the common case for weight-sorted manifests, so
+        // keep the old leaf full instead of leaving two half-empty leaves behind
+        int keep = (position == BST_LEAF_CAPACITY && !leaf->next) ? BST_LEAF_CAPACITY : (BST_LEAF_CAPACITY + 1) / 2;
+        if (position < keep) {
+            // The new parcel lands in the left half
+            right->count = BST_LEAF_CAPACITY - (keep - 1);
+            memcpy(right->weights, &leaf->weights[keep - 1], right->count * sizeof(int));
+            memcpy(right->parcels, &leaf->parcels[keep - 1], right->count * sizeof(Parcel*));
+            leaf->count = keep - 1;
+            insertIntoLeaf(leaf, position, parcel);
+        }
+        else {
+            // The new parcel lands in the right half
+            right->count = BST_LEAF_CAPACITY - keep;
+            memcpy(right->weights, &leaf->weights[keep], right->count * sizeof(int));
+            memcpy(right->parcels, &leaf->parcels[keep], right->count * sizeof(Parcel*));
+            leaf->count = keep;
+            insertIntoLeaf(right, position - keep, parcel);
+        }
+
+        summarizeLeaf(leaf);
+        summarizeLeaf(right);
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        }
+        else {
+            tail = right;
+        }
+        leaf->next = right;
+        return right;
+    }
+    // Helper function to split a full inner node while inserting a separator and child into it
+    // Returns the new right sibling and stores the separator to push upwards in 'promoted'
+    BSTInnerNode* splitInner(BSTInnerNode* inner, int slot, int key, BSTNode* child, int& promoted) {
+        // Lay out the overfull node in temporary arrays, then divide it in two
+        int keys[BST_INNER_CAPACITY + 1];
+        BSTNode* children[BST_INNER_CAPACITY + 2];
+        memcpy(keys, inner->keys, slot * sizeof(int));
+        memcpy(children, inner->children, (slot + 1) * sizeof(BSTNode*));
+        keys[slot] = key;
+        children[slot + 1] = child;
+        memcpy(&keys[slot + 1], &inner->keys[slot], (BST_INNER_CAPACITY - slot) * sizeof(int));
+        memcpy(&children[slot + 2], &inner->children[slot + 1], (BST_INNER_CAPACITY - slot) * sizeof(BSTNode*));
+
+        int middle = (BST_INNER_CAPACITY + 1) / 2;
+        BSTInnerNode* right = new (innerPool.allocate()) BSTInnerNode();
+        inner->count = middle;
+        memcpy(inner->keys, keys, middle * sizeof(int));
+        memcpy(inner->children, children, (middle + 1) * sizeof(BSTNode*));
+        right->count = BST_INNER_CAPACITY - middle;
+        memcpy(right->keys, &keys[middle + 1], right->count * sizeof(int));
+        memcpy(right->children, &children[middle + 1], (right->count + 1) * sizeof(BSTNode*));
+        promoted = keys[middle];
+        summarizeInner(inner);
+        summarizeInner(right);
+        return right;
+    }
+    // Helper function to rebuild a leaf's summary from the parcels it holds
+    void summarizeLeaf(BSTDataNode* leaf) {
+        leaf->summary.clear();
+        for (int i = 0; i < leaf->count; i++) {
+            leaf->summary.add(leaf->parcels[i]);
+        }
+    }
+    // Helper function to rebuild an inner node's summary from its children's summaries
+    void summarizeInner(BSTInnerNode* inner) {
+        inner->summary.clear();
+        for (int i = 0; i <= inner->count; i++) {
+            inner->summary.merge(inner->children[i]->summary);
+        }
+    }
+    // Function to fill an empty tree from parcels that are already sorted by weight
+    // Leaves are packed full and each level of inner nodes is built directly from the one
+    // below, so no parcel is searched for and no node is ever split
+    void buildFromSorted(int countryId, const int* weights, const int64_t* valuations, size_t count) {
+        if (root || count == 0) {
+            return;
+        }
+        // Pack the parcels into as few leaves as possible, spreading them evenly
+        size_t leafCount = (count + BST_LEAF_CAPACITY - 1) / BST_LEAF_CAPACITY;
+        vector<BSTNode*> level(leafCount);
+        vector<int> lowestWeights(leafCount);
+        BSTDataNode* previous = nullptr;
+        size_t next = 0;
+        for (size_t i = 0; i < leafCount; i++) {
+            BSTDataNode* leaf = new (leafPool.allocate()) BSTDataNode();
+            leaf->count = (int)(count / leafCount + (i < count % leafCount ? 1 : 0));
+            for (int j = 0; j < leaf->count; j++, next++) {
+                leaf->weights[j] = weights[next];
+                leaf->parcels[j] = new (parcelPool.allocate()) Parcel(countryId, weights[next], valuations[next]);
+            }
+            summarizeLeaf(leaf);
+            leaf->prev = previous;
+            if (previous) {
+                previous->next = leaf;
+            }
+            previous = leaf;
+            level[i] = leaf;
+            lowestWeights[i] = leaf->weights[0];
+        }
+        head = static_cast<BSTDataNode*>(level[0]);
+        tail = previous;
+        height = 1;
+
+        // Group each level under inner nodes until a single root is left
+        while (level.size() > 1) {
+            size_t nodeCount = (level.size() + BST_INNER_CAPACITY) / (BST_INNER_CAPACITY + 1);
+            vector<BSTNode*> parents(nodeCount);
+            vector<int> parentWeights(nodeCount);
+            size_t child = 0;
+            for (size_t i = 0; i < nodeCount; i++) {
+                BSTInnerNode* inner = new (innerPool.allocate()) BSTInnerNode();
+                size_t children = level.size() / nodeCount + (i < level.size() % nodeCount ? 1 : 0);
+                parentWeights[i] = lowestWeights[child];
+                for (size_t j = 0; j < children; j++, child++) {
+                    inner->children[j] = level[child];
+                    if (j > 0) {
+                        inner->keys[j - 1] = lowestWeights[child];
+                    }
+                }
+                inner->count = (int)children - 1;
+                summarizeInner(inner);
+                parents[i] = inner;
+            }
+            level.swap(parents);
+            lowestWeights.swap(parentWeights);
+            height++;
+        }
+        root = level[0];
+        version += (long long)count;
+    }
+    // Function to feed the parcels weighing between minWeight and maxWeight, inclusive, through every
+    // aggregate in one pass, lightest first
+    // The aggregates are fixed at compile time, so the pass is a single inlined loop. When all of them
+    // can take whole subtrees, subtrees inside the range are merged from their summaries and only the
+    // parcels at the two edges of the range are visited.
+    template <typename... Aggregates>
+    void query(int minWeight, int maxWeight, Aggregates&... aggregates) {
+        if (!root || minWeight > maxWeight) {
+            return;
+        }
+        if constexpr ((Aggregates::wholeSubtrees && ...)) {
+            queryRange(root, INT_MIN, INT_MAX, minWeight, maxWeight, aggregates...);
+        }
+        else {
+            forEach(minWeight, maxWeight, [&](Parcel* parcel) {
+                // Every aggregate sees the parcel, even when one of them stops the walk at it
+                bool more = true;
+                ((more &= offerParcel(aggregates, parcel)), ...);
+                return more;
+            });
+        }
+    }
+    // Helper function for query; every parcel below 'node' is known to weigh between low and high
+    // The recursion only follows the two edges of the range, so it is bounded by the tree height
+    template <typename... Aggregates>
+    void queryRange(BSTNode* node, int low, int high, int minWeight, int maxWeight, Aggregates&... aggregates) {
+        if (minWeight <= low && high <= maxWeight) {
+            (aggregates.merge(node), ...);
+            return;
+        }
+        if (node->isLeaf) {
+            BSTDataNode* leaf = static_cast<BSTDataNode*>(node);
+            for (int i = lowerBound(leaf->weights, leaf->count, minWeight); i < leaf->count && leaf->weights[i] <= maxWeight; i++) {
+                (aggregates.add(leaf->parcels[i]), ...);
+            }
+            return;
+        }
+        BSTInnerNode* inner = static_cast<BSTInnerNode*>(node);
+        for (int i = 0; i <= inner->count; i++) {
+            int childLow = (i == 0) ? low : inner->keys[i - 1];
+            int childHigh = (i == inner->count) ? high : inner->keys[i];
+            if (childHigh >= minWeight && childLow <= maxWeight) {
+                queryRange(inner->children[i], childLow, childHigh, minWeight, maxWeight, aggregates...);
+            }
+        }
+    }
+    // Function to add the tree's parcel and node counts and reserved bytes to 'memory'
+    void addMemoryUsage(IndexMemory& memory) {
+        memory.parcels += parcelPool.live;
+        memory.leaves += leafPool.live;
+        memory.innerNodes += innerPool.live;
+        memory.reservedBytes += parcelPool.reservedBytes + leafPool.reservedBytes + innerPool.reservedBytes;
+    }
+    // Function to drop every parcel and node at once, leaving the tree empty
+    void clear() {
+        root = nullptr;
+        head = tail = nullptr;
+        height = 0;
+        version++;
+        parcelPool.clear();
+        leafPool.clear();
+        innerPool.clear();
+    }
+    // The BST needs no destructor: its pools free every parcel and node a slab at a time
+};
+
+// Define a struct for a column-oriented copy of one country's parcels, sorted by weight
+// Weights and valuations sit in their own contiguous arrays so the aggregation kernels
+// can stream through them with vector instructions instead of chasing Parcel pointers
+struct CountryColumns {
+    vector<int> weights;        // Parcel weights in ascending order
+    vector<int64_t> valuations; // Valuations in cents, in the same order as weights
+    vector<Parcel*> parcels;    // The parcels themselves, in the same order as weights
+    long long version;          // BST version the columns were built from
+    CountryColumns() : version(-1) {}
+    // Function to refill the columns from the tree's leaves
+    void build(BST& tree) {
+        size_t count = tree.root ? (size_t)tree.root->summary.count : 0;
+        weights.resize(count);
+        valuations.resize(count);
+        parcels.resize(count);
+        size_t next = 0;
+        for (BSTDataNode* leaf = tree.head; leaf; leaf = leaf->next) {
+            for (int i = 0; i < leaf->count; i++, next++) {
+                weights[next] = leaf->weights[i];
+                valuations[next] = leaf->parcels[i]->valuation;
+                parcels[next] = leaf->parcels[i];
+            }
+        }
+        version = tree.version;
+    }
+};
+
+// When true, the total, cost and lightest/heaviest queries run on CountryColumns (set by --columnar)
+bool columnarQueries = false;
+
+// Where load, snapshot and memory reports are printed; batch mode moves them to stderr so stdout holds only results
+FILE* statusOutput = stdout;
+
+// When true, operations are timed into operationStats (set by --stats or --stats-json)
+bool statsEnabled = false;
+
+// Operations timed into operationStats
+enum Operation {
+    OP_LOAD,            // Loading the manifest text
+    OP_SNAPSHOT_LOAD,   // Loading, or trying to load, the snapshot
+    OP_INSERT,          // Inserting one parcel after the initial load
+    OP_REMOVE,          // Removing one parcel
+    OP_UPDATE,          // Changing the weight or valuation of one parcel
+    OP_LIST,            // Menu 1 and batch list
+    OP_HEAVIER,         // Menu 2 'H' and batch heavier
+    OP_LIGHTER,         // Menu 2 'L' and batch lighter
+    OP_RANGE,           // Menu 2 'R' and batch range
+    OP_TOTALS,          // Menu 3 and batch totals
+    OP_COST,            // Menu 4 and batch cost
+    OP_EXTREMES,        // Menu 5 and batch extremes
+    OP_TOP_K,           // Menu 8 and batch cheapest, costliest and heaviest
+    OP_PERCENTILES,     // Batch percentiles
+    OP_REPORT,          // Menu 9 and --report
+    OP_SHARD_LOAD,      // Loading one country from its shard in lazy mode
+    OPERATION_COUNT
+};
+
+// Names of the operations, as shown by the stats menu option and dump
+const char* operationNames[OPERATION_COUNT] = { "load", "snapshot_load", "insert", "remove", "update", "list", "heavier", "lighter", "range", "totals", "cost", "extremes", "top_k", "percentiles", "report", "shard_load" };
+
+// Define a struct for a histogram of operation latencies
+// Each power of two of nanoseconds is split into 8 buckets, so a percentile read back from
+// it is within 12.5% of the true value. The counters are atomic because queries, inserts
+// and the follower can record at the same time.
+struct LatencyHistogram {
+    atomic<long long> buckets[STATS_HISTOGRAM_BUCKETS];    // Operations that took each bucket's range of time
+    atomic<long long> count;            // Operations recorded
+    atomic<long long> totalNanoseconds; // Time taken by all of them
+    atomic<long long> maxNanoseconds;   // Time taken by the slowest
+    LatencyHistogram() : count(0), totalNanoseconds(0), maxNanoseconds(0) {
+        for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+            buckets[i] = 0;
+        }
+    }
+    // Function to return the bucket that holds a latency
+    static int bucketOf(long long nanoseconds) {
+        if (nanoseconds < 8) {
+            return nanoseconds < 0 ? 0 : (int)nanoseconds;
+        }
+        int topBit = 3;
+        while (topBit < 62 && (nanoseconds >> (topBit + 1)) != 0) {
+            topBit++;
+        }
+        int bucket = (topBit - 2) * 8 + (int)((nanoseconds >> (topBit - 3)) & 7);
+        return bucket < STATS_HISTOGRAM_BUCKETS ? bucket : STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    // Function to return the largest latency that falls in a bucket
+    static long long bucketLimit(int bucket) {
+        if (bucket < 8) {
+            return bucket;
+        }
+        int topBit = bucket / 8 + 2;
+        return ((8LL + bucket % 8 + 1) << (topBit - 3)) - 1;
+    }
+    // Function to record one operation
+    void record(long long nanoseconds) {
+        buckets[bucketOf(nanoseconds)].fetch_add(1, memory_order_relaxed);
+        count.fetch_add(1, memory_order_relaxed);
+        totalNanoseconds.fetch_add(nanoseconds, memory_order_relaxed);
+        long long slowest = maxNanoseconds.load(memory_order_relaxed);
+        while (nanoseconds > slowest && !maxNanoseconds.compare_exchange_weak(slowest, nanoseconds, memory_order_relaxed)) {
+        }
+    }
+    // Function to return the latency that 'fraction' of the recorded operations took at most
+    long long percentile(double fraction) const {
+        long long total = count.load(memory_order_relaxed);
+        long long target = (long long)ceil(fraction * total);
+        long long seen = 0;
+        for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i].load(memory_order_relaxed);
+            if (seen >= target && seen > 0) {
+                long long limit = bucketLimit(i);
+                long long slowest = maxNanoseconds.load(memory_order_relaxed);
+                return limit < slowest ? limit : slowest;
+            }
+        }
+        return 0;
+    }
+};
+
+// Latency histogram of each operation
+LatencyHistogram operationStats[OPERATION_COUNT];
+
+// Define a struct that times one operation into its histogram from construction to destruction
+// Nothing is timed while statistics are off, so the cost is then a single test of statsEnabled
+struct OperationTimer {
+    Operation operation;                        // Operation being timed
+    bool active;                                // Whether statistics were on when timing started
+    chrono::steady_clock::time_point start;     // When the operation started
+    OperationTimer(Operation op) : operation(op), active(statsEnabled) {
+        if (active) {
+            start = chrono::steady_clock::now();
+        }
+    }
+    ~OperationTimer() {
+        if (active) {
+            operationStats[operation].record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        }
+    }
+};
+
+// Define a struct for one country's entry in the Hash Table
+// Each country gets its own BST, and entries stay at the same address for the life of the table
+struct CountryIndex {
+    int countryId;              // ID in countryDictionary of the country this entry is keyed on
+    BST tree;                   // Parcels for this country, ordered by weight
+    CountryColumns* columns;    // Column copy of the tree, built the first time it is needed
+    ReadWriteLock lock;         // Held shared while the tree or columns are read, exclusively while they change
+    bool resident;              // False in lazy mode while the country's parcels are still in its shard
+    int shard;                  // Shard file holding the country's parcels in lazy mode, or -1
+    int64_t shardOffset;        // Position of the country's columns in the shard file
+    int shardParcels;           // Parcels the country has in the shard file
+    uint64_t shardChecksum;     // Checksum of the country's columns in the shard file, from the shard index
+    bool pinned;                // Set in lazy mode once the tree has been changed, after which it is never evicted
+    size_t loadedBytes;         // Heap bytes the tree counts against the lazy memory budget
+    atomic<uint64_t> lastUsed;  // Tick of the lazy clock at the tree's latest use, for picking the coldest to evict
+    CountryIndex(int c) : countryId(c), columns(nullptr), resident(true), shard(-1), shardOffset(0), shardParcels(0),
+        shardChecksum(0), pinned(false), loadedBytes(0), lastUsed(0) {}
+    ~CountryIndex() {
+        delete columns;
+    }
+};
+
+// Moves a file's position to a byte offset that may be past 2 GB; returns false if it cannot
+static bool seekFile(FILE* file, int64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Folds a block of bytes into a running checksum, eight bytes at a time
+// Blocks can be checksummed one after another as long as all but the last are a multiple of 8 bytes
+static uint64_t checksumBlock(uint64_t checksum, const unsigned char* data, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        checksum = (checksum ^ word) * 1099511628211ULL;
+    }
+    for (; i < size; i++) {
+        checksum = (checksum ^ data[i]) * 1099511628211ULL;
+    }
+    return checksum;
+}
+
+// Checksums one country's weight and valuation columns as a shard file stores them
+static uint64_t checksumColumns(const vector<int>& weights, const vector<int64_t>& valuations) {
+    uint64_t checksum = checksumBlock(SNAPSHOT_CHECKSUM_SEED, (const unsigned char*)weights.data(), weights.size() * sizeof(int));
+    return checksumBlock(checksum, (const unsigned char*)valuations.data(), valuations.size() * sizeof(int64_t));
+}
+
+// Define a struct for the first line of a shard index
+// Every partitioning writes a new generation of shard files, so the index in place keeps pointing
+// at complete files of its own generation until a newer index is renamed over it
+struct ShardIndexHeader {
+    long long generation;       // Generation of the shard files the index lists, from 1 up
+    int fileCount;              // Shard numbers the partitioning used, some of which may have no file
+    int countryCount;           // Countries listed in the index
+    long long parcelCount;      // Parcels in all the shard files together
+    ShardIndexHeader() : generation(0), fileCount(0), countryCount(0), parcelCount(0) {}
+};
+
+// Define a struct for lazy mode, where each country's parcels stay in a partitioned manifest
+// until the country is first used, and the least recently used countries are evicted again
+// once the loaded trees outgrow the memory budget
+// Each shard holds, for every country in it, the country's weights and then its valuations in
+// cents as two columns sorted by weight, so loading a country is two reads and a bulk build
+struct LazyShards {
+    const char* directory;              // Directory holding the shard files and their index
+    long long generation;               // Generation of the shard files the index points at
+    size_t budget;                      // Heap bytes the loaded trees may use before cold countries are evicted
+    atomic<uint64_t> clock;             // Ticks at every use of a tree; CountryIndex::lastUsed records it
+    mutex lock;                         // Guards the fields below
+    vector<pair<uint64_t, CountryIndex*>> coldest; // Min-heap of unchanged loaded countries by the tick they were filed under
+    size_t loadedCount;                 // Countries whose trees are in memory, changed ones included
+    size_t loadedBytes;                 // Heap bytes held by those trees
+    long long loads;                    // Countries loaded from their shards
+    long long evictions;                // Countries evicted to stay within the budget
+    long long pinned;                   // Countries changed in memory, which stay counted but are never evicted
+    bool overBudget;                    // Set once the budget could not be met, so that is reported only once
+    LazyShards(const char* d, long long g, size_t b) : directory(d), generation(g), budget(b), clock(0), loadedCount(0), loadedBytes(0), loads(0), evictions(0),
+        pinned(0), overBudget(false) {}
+    // Function to read a country's columns from its shard and build its tree, then evict colder
+    // countries if the budget is exceeded; called with the entry's lock held exclusively
+    // A shard that cannot be read, or whose columns do not match the index's checksum, leaves the
+    // country empty and not resident, after a message, so its next use tries again
+    void load(CountryIndex* entry) {
+        OperationTimer timer(OP_SHARD_LOAD);
+        char path[FILENAME_MAX];
+        snprintf(path, sizeof(path), "%s/" SHARD_FILE_FORMAT, directory, generation, entry->shard);
+        size_t count = (size_t)entry->shardParcels;
+        vector<int> weights(count);
+        vector<int64_t> valuations(count);
+        FILE* file = fopen(path, "rb");
+        bool read = file && seekFile(file, entry->shardOffset) && fread(weights.data(), sizeof(int), count, file) == count
+            && fread(valuations.data(), sizeof(int64_t), count, file) == count;
+        if (file) {
+            fclose(file);
+        }
+        read = read && checksumColumns(weights, valuations) == entry->shardChecksum && is_sorted(weights.begin(), weights.end());
+        if (!read) {
+            fprintf(statusOutput, "Failed to load %s from shard %s\n", countryDictionary.name(entry->countryId), path);
+            return;
+        }
+        // Columns built from the empty tree after an earlier failed load would look current, as building
+        // the tree does not move its version
+        delete entry->columns;
+        entry->columns = nullptr;
+        entry->tree.buildFromSorted(entry->countryId, weights.data(), valuations.data(), count);
+        IndexMemory memory;
+        entry->tree.addMemoryUsage(memory);
+        entry->resident = true;
+        entry->loadedBytes = memory.reservedBytes;
+        entry->lastUsed.store(clock.fetch_add(1, memory_order_relaxed), memory_order_relaxed);
+
+        lock_guard<mutex> guard(lock);
+        coldest.push_back(make_pair(entry->lastUsed.load(memory_order_relaxed), entry));
+        push_heap(coldest.begin(), coldest.end(), greater<pair<uint64_t, CountryIndex*>>());
+        loadedCount++;
+        loadedBytes += entry->loadedBytes;
+        loads++;
+        if (loadedBytes > budget) {
+            evictColdest(entry);
+        }
+    }
+    // Function to account for a change to a country's tree; called with the entry's lock held exclusively
+    // A changed tree is pinned, since evicting it would lose the change, but its bytes still count
+    // against the budget, and colder countries are evicted to make room for its growth
+    void noteChange(CountryIndex* entry) {
+        IndexMemory memory;
+        entry->tree.addMemoryUsage(memory);
+        lock_guard<mutex> guard(lock);
+        if (!entry->pinned) {
+            entry->pinned = true;
+            pinned++;
+            if (entry->shard < 0) {
+                // A country that is not in any shard was never loaded, so it is counted from its first change
+                loadedCount++;
+            }
+        }
+        loadedBytes = loadedBytes - entry->loadedBytes + memory.reservedBytes;
+        entry->loadedBytes = memory.reservedBytes;
+        if (loadedBytes > budget) {
+            evictColdest(entry);
+        }
+    }
+    // Helper function for load to evict the least recently used countries until the loaded trees fit
+    // 'keep' is never evicted, so a country bigger than the whole budget can still be used. Countries
+    // someone is using are skipped rather than waited for, and changed countries are kept. If what is
+    // left still does not fit, that is reported once, until the loaded trees fit again.
+    // Uses do not touch the heap: a country used since it was filed is refiled under its latest tick
+    // when it comes to the top, so each miss only pops what it evicts plus what was used meanwhile
+    void evictColdest(CountryIndex* keep) {
+        greater<pair<uint64_t, CountryIndex*>> later;
+        vector<pair<uint64_t, CountryIndex*>> skipped;
+        while (loadedBytes > budget && !coldest.empty()) {
+            pop_heap(coldest.begin(), coldest.end(), later);
+            pair<uint64_t, CountryIndex*> top = coldest.back();
+            coldest.pop_back();
+            CountryIndex* entry = top.second;
+            if (entry->pinned) {
+                continue;
+            }
+            uint64_t lastUsed = entry->lastUsed.load(memory_order_relaxed);
+            if (lastUsed != top.first) {
+                coldest.push_back(make_pair(lastUsed, entry));
+                push_heap(coldest.begin(), coldest.end(), later);
+                continue;
+            }
+            unique_lock<ReadWriteLock> entryGuard(entry->lock, try_to_lock);
+            if (entry == keep || !entryGuard.owns_lock()) {
+                skipped.push_back(top);
+                continue;
+            }
+            loadedBytes -= entry->loadedBytes;
+            entry->loadedBytes = 0;
+            entry->tree.clear();
+            delete entry->columns;
+            entry->columns = nullptr;
+            entry->resident = false;
+            loadedCount--;
+            evictions++;
+        }
+        for (size_t i = 0; i < skipped.size(); i++) {
+            coldest.push_back(skipped[i]);
+            push_heap(coldest.begin(), coldest.end(), later);
+        }
+        if (loadedBytes > budget && !overBudget) {
+            fprintf(statusOutput, "Lazy memory budget of %.1f MB exceeded: %.1f MB loaded, including %lld changed countries, which cannot be evicted\n",
+                budget / (1024.0 * 1024.0), loadedBytes / (1024.0 * 1024.0), pinned);
+        }
+        overBudget = loadedBytes > budget;
+    }
+};
+
+// Define a struct for read access to one country's tree
+// It holds the country's lock in shared mode for as long as it lives, so the tree cannot
+// change while it is being read; other readers, and inserts into other countries, carry on
+struct TreeReader {
+    BST* tree;                          // The country's tree, or nullptr when it has no entry
+    shared_lock<ReadWriteLock> guard;    // Shared hold on the country's lock
+    TreeReader() : tree(nullptr) {}
+    TreeReader(CountryIndex* entry, shared_lock<ReadWriteLock>&& g) : tree(&entry->tree), guard(move(g)) {}
+    BST* operator->() const {
+        return tree;
+    }
+    explicit operator bool() const {
+        return tree != nullptr;
+    }
+};
+
+// Define a struct for read access to one country's columns, kept up to date with its tree
+struct ColumnsReader {
+    CountryColumns* columns;            // The country's columns, or nullptr when it has no entry
+    shared_lock<ReadWriteLock> guard;    // Shared hold on the country's lock
+    ColumnsReader() : columns(nullptr) {}
+    CountryColumns* operator->() const {
+        return columns;
+    }
+    explicit operator bool() const {
+        return columns != nullptr;
+    }
+};
+
+// Define a struct for the Hash Table
+// The Hash Table maps each country to the BST holding only that country's parcels.
+// Countries are identified by their countryDictionary ID, and the slots are an open table
+// keyed on a hash of the ID. Multiplying by an odd constant maps distinct IDs to distinct
+// hashes, so a matching hash is a match and a lookup never leaves the slot array.
+// Entries are only ever added, and growing the table moves only pointers, so an entry
+// found under the table lock stays valid after it is released; each entry's own lock
+// then guards its tree, and queries on one country only wait for inserts into that same country.
+struct HashTable {
+    OpenTable<CountryIndex*> table;     // Entry of each country, keyed on hashId of its ID
+    vector<CountryIndex*> entries;      // Every entry, in the order the countries were first seen
+    ReadWriteLock lock;     // Held shared while the table is searched, exclusively while an entry is added
+    LazyShards* shards;     // Where countries are loaded from on first use in lazy mode, or nullptr
+
+    HashTable() : table(HASH_TABLE_FIRST_SIZE), shards(nullptr) {}
+    // Hash function to compute the slot hash of a country ID
+    static uint32_t hashId(int countryId) {
+        return (uint32_t)countryId * 0x9E3779B1u;
+    }
+    // Function to find the entry for a country ID, or nullptr if it has none
+    CountryIndex* findEntry(int countryId) {
+        shared_lock<ReadWriteLock> guard(lock);
+        return findEntryUnlocked(countryId);
+    }
+    // Helper function for findEntry, called with the lock already held
+    CountryIndex* findEntryUnlocked(int countryId) {
+        CountryIndex* const* entry = table.find(hashId(countryId), [](CountryIndex*) { return true; });
+        return entry ? *entry : nullptr;
+    }
+    // Function to find the entry for a country ID, adding an empty one if it has none
+    CountryIndex* findOrCreateEntry(int countryId) {
+        CountryIndex* entry = findEntry(countryId);
+        if (entry) {
+            return entry;
+        }
+        unique_lock<ReadWriteLock> guard(lock);
+        entry = findEntryUnlocked(countryId);
+        if (!entry) {
+            entry = new CountryIndex(countryId);
+            entries.push_back(entry);
+            table.insert(hashId(countryId), entry);
+        }
+        return entry;
+    }
+    // Function to insert a parcel into its country's BST, creating the entry on first use
+    Parcel* insert(int countryId, int weight, int64_t valuation) {
+        OperationTimer timer(OP_INSERT);
+        CountryIndex* entry = findOrCreateEntry(countryId);
+        unique_lock<ReadWriteLock> guard = holdResidentExclusive(entry);
+        if (!entry->resident) {
+            return nullptr;
+        }
+        Parcel* parcel = entry->tree.insert(countryId, weight, valuation);
+        if (shards) {
+            shards->noteChange(entry);
+        }
+        return parcel;
+    }
+    // Function to remove one parcel with the given weight and valuation from its country's BST
+    // Returns false if the country has no such parcel; its entry stays even once it is empty
+    bool remove(int countryId, int weight, int64_t valuation) {
+        OperationTimer timer(OP_REMOVE);
+        CountryIndex* entry = findEntry(countryId);
+        if (!entry) {
+            return false;
+        }
+        unique_lock<ReadWriteLock> guard = holdResidentExclusive(entry);
+        if (!entry->resident) {
+            return false;
+        }
+        bool removed = entry->tree.remove(weight, valuation);
+        if (removed && shards) {
+            shards->noteChange(entry);
+        }
+        return removed;
+    }
+    // Function to change the weight and valuation of one of a country's parcels
+    // Returns false if the country has no parcel with the old weight and valuation
+    bool update(int countryId, int weight, int64_t valuation, int newWeight, int64_t newValuation) {
+        OperationTimer timer(OP_UPDATE);
+        CountryIndex* entry = findEntry(countryId);
+        if (!entry) {
+            return false;
+        }
+        unique_lock<ReadWriteLock> guard = holdResidentExclusive(entry);
+        if (!entry->resident) {
+            return false;
+        }
+        bool updated = entry->tree.update(weight, valuation, newWeight, newValuation) != nullptr;
+        if (updated && shards) {
+            shards->noteChange(entry);
+        }
+        return updated;
+    }
+    // Function to take a shared hold on an entry's lock once its tree is loaded
+    // In lazy mode a country still in its shard is loaded first, and the use is stamped for eviction
+    shared_lock<ReadWriteLock> holdResident(CountryIndex* entry) {
+        for (;;) {
+            shared_lock<ReadWriteLock> guard(entry->lock);
+            if (entry->resident) {
+                if (shards) {
+                    entry->lastUsed.store(shards->clock.fetch_add(1, memory_order_relaxed), memory_order_relaxed);
+                }
+                return guard;
+            }
+            // Loading needs the lock exclusively, and the country may be evicted again before the
+            // shared hold is back, so check again once it is
+            guard.unlock();
+            unique_lock<ReadWriteLock> loading = holdResidentExclusive(entry);
+            if (!entry->resident) {
+                // The shard could not be read, so this use sees the country empty and the next tries again
+                loading.unlock();
+                return shared_lock<ReadWriteLock>(entry->lock);
+            }
+        }
+    }
+    // Function to take an exclusive hold on an entry's lock once its tree is loaded
+    // The country is still not resident if its shard could not be read; callers must not change it then
+    unique_lock<ReadWriteLock> holdResidentExclusive(CountryIndex* entry) {
+        unique_lock<ReadWriteLock> guard(entry->lock);
+        if (!entry->resident) {
+            shards->load(entry);
+        }
+        else if (shards) {
+            entry->lastUsed.store(shards->clock.fetch_add(1, memory_order_relaxed), memory_order_relaxed);
+        }
+        return guard;
+    }
+    // Function to get read access to the BST holding a given country's parcels
+    // The name is resolved to an ID once; the reader is empty when the country has no parcels
+    TreeReader getTree(const char* country) {
+        int countryId = countryDictionary.find(country);
+        return countryId >= 0 ? getTree(countryId) : TreeReader();
+    }
+    // Function to get read access to the BST holding the parcels of a country ID
+    TreeReader getTree(int countryId) {
+        CountryIndex* entry = findEntry(countryId);
+        return entry ? TreeReader(entry, holdResident(entry)) : TreeReader();
+    }
+    // Function to get read access to the column copy of a country's parcels, rebuilding it if the tree has changed
+    // The reader is empty when the country has no parcels
+    ColumnsReader getColumns(const char* country) {
+        int countryId = countryDictionary.find(country);
+        CountryIndex* entry = countryId >= 0 ? findEntry(countryId) : nullptr;
+        ColumnsReader reader;
+        if (!entry) {
+            return reader;
+        }
+        // Rebuilding needs the lock exclusively; an insert can slip in before the shared hold
+        // is taken, so check again and rebuild until the columns match the tree being read
+        for (;;) {
+            reader.guard = holdResident(entry);
+            if (entry->columns && entry->columns->version == entry->tree.version) {
+                reader.columns = entry->columns;
+                return reader;
+            }
+            reader.guard.unlock();
+            unique_lock<ReadWriteLock> guard(entry->lock);
+            if (!entry->columns) {
+                entry->columns = new CountryColumns();
+            }
+            if (entry->columns->version != entry->tree.version) {
+                entry->columns->build(entry->tree);
+            }
+        }
+    }
+    // Function to total up the memory used by every country's parcels and nodes
+    IndexMemory memoryUsage() {
+        IndexMemory memory;
+        shared_lock<ReadWriteLock> guard(lock);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            CountryIndex* entry = entries[i];
+            shared_lock<ReadWriteLock> entryGuard(entry->lock);
+            entry->tree.addMemoryUsage(memory);
+            memory.entries++;
+            memory.reservedBytes += sizeof(CountryIndex);
+        }
+        memory.reservedBytes += table.slots.capacity() * sizeof(table.slots[0]) + entries.capacity() * sizeof(CountryIndex*);
+        memory.reservedBytes += countryDictionary.reservedBytes;
+        return memory;
+    }
+    // Function to count every country's parcels, including those still in their shards in lazy mode
+    long long parcelCount() {
+        long long count = 0;
+        shared_lock<ReadWriteLock> guard(lock);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            CountryIndex* entry = entries[i];
+            shared_lock<ReadWriteLock> entryGuard(entry->lock);
+            count += entry->resident ? entry->tree.parcelPool.live : entry->shardParcels;
+        }
+        return count;
+    }
+    // Destructor to clean up the Hash Table by deleting every country's entry
+    ~HashTable() {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            delete entries[i];
+        }
+        delete shards;
+    }
+};
+
+// Define a struct for a read-only view of a whole file mapped into memory
+struct MappedFile {
+    const char* data;   // First byte of the file, nullptr when the file is empty or not open
+    size_t size;        // Size of the file in bytes
+#ifdef _WIN32
+    HANDLE file;        // Handle of the open file
+    HANDLE mapping;     // Handle of the file mapping object
+    MappedFile() : data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+#else
+    int descriptor;     // Descriptor of the open file
+    MappedFile() : data(nullptr), size(0), descriptor(-1) {}
+#endif
+    // Function to map a file into memory; returns false if it cannot be opened or mapped
+    bool open(const char* filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length)) {
+            close();
+            return false;
+        }
+        size = (size_t)length.QuadPart;
+        if (size == 0) {
+            return true;  // Empty files cannot be mapped, but there is nothing to read anyway
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+#else
+        descriptor = ::open(filename, O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) {
+            close();
+            return false;
+        }
+        size = (size_t)info.st_size;
+        if (size == 0) {
+            return true;  // Empty files cannot be mapped, but there is nothing to read anyway
+        }
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (view != MAP_FAILED) {
+            data = (const char*)view;
+            madvise(view, size, MADV_SEQUENTIAL);
+        }
+#endif
+        if (!data) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    // Function to unmap the file and release its handles
+    void close() {
+#ifdef _WIN32
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) {
+            munmap((void*)data, size);
+        }
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+        descriptor = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+    ~MappedFile() {
+        close();
+    }
+};
+
+// Define a struct for one parsed line of the manifest, before it is turned into a Parcel
+struct ParcelRecord {
+    const char* country;    // Destination country, pointing into the mapped manifest
+    int countryLength;      // Length of the country name
+    int weight;             // Weight of the parcel
+    int64_t valuation;      // Valuation of the parcel, in cents
+};
+
+// Define a struct for the slice of the manifest parsed by one loader thread
+// Slices always start at the beginning of a line and end just after a newline (or at end of file)
+struct LoadChunk {
+    const char* begin;              // First byte of the slice
+    const char* end;                // One past the last byte of the slice
+    vector<ParcelRecord> records;   // Parcels parsed from the slice, in file order
+    vector<int> countryIds;         // Dictionary ID of each record's country, filled in by prepareChunk
+    long long lines;                // Number of lines in the slice
+    long long malformed;            // Number of malformed lines that were skipped
+    long long malformedLines[MAX_REPORTED_MALFORMED_LINES];  // Slice-relative numbers of the first malformed lines
+    LoadChunk() : begin(nullptr), end(nullptr), lines(0), malformed(0) {}
+};
+
+// Define a struct for the header at the start of a snapshot file
+// The payload after it holds a SnapshotCountry per country, the country names, and
+// then every parcel's weight and valuation in cents as two columns, grouped by country and
+// sorted by weight within each country. Each section starts on an 8-byte boundary.
+struct SnapshotHeader {
+    char magic[8];              // SNAPSHOT_MAGIC
+    uint32_t version;           // SNAPSHOT_VERSION of the program that wrote the file
+    uint32_t countryCount;      // Number of SnapshotCountry records
+    uint64_t parcelCount;       // Number of parcels in the weight and valuation columns
+    uint64_t namesSize;         // Bytes in the country name section, including padding
+    int64_t sourceSize;         // Size of the manifest the snapshot was built from
+    int64_t sourceModified;     // Modification time of that manifest, in nanoseconds
+    uint64_t payloadSize;       // Bytes following the header
+    uint64_t checksum;          // Checksum of the payload
+};
+
+// Define a struct for one country's record in a snapshot file
+struct SnapshotCountry {
+    uint64_t nameOffset;        // Offset of the name within the name section
+    uint64_t firstParcel;       // Position of the country's first parcel in the columns
+    uint64_t parcelCount;       // Number of parcels for the country
+    uint32_t nameLength;        // Length of the name, which is not null terminated
+    uint32_t reserved;          // Always zero
+};
+
+// Define a struct for a buffered writer that checksums everything written through it
+// The buffer is only flushed when full, so every block but the last is a whole number
+// of 8-byte words and the running checksum matches one computed over the whole payload
+struct SnapshotWriter {
+    FILE* file;             // File being written
+    vector<unsigned char> buffer;   // Bytes waiting to be written
+    size_t used;            // Bytes of the buffer in use
+    uint64_t checksum;      // Checksum of everything flushed so far
+    uint64_t written;       // Bytes passed to write so far
+    bool failed;            // True once any write has failed
+    SnapshotWriter(FILE* f) : file(f), buffer(SNAPSHOT_BUFFER_SIZE), used(0), checksum(SNAPSHOT_CHECKSUM_SEED), written(0), failed(false) {}
+    // Function to append bytes to the payload
+    void write(const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        written += size;
+        while (size > 0) {
+            size_t chunk = buffer.size() - used;
+            if (chunk > size) {
+                chunk = size;
+            }
+            memcpy(&buffer[used], bytes, chunk);
+            used += chunk;
+            bytes += chunk;
+            size -= chunk;
+            if (used == buffer.size()) {
+                flush();
+            }
+        }
+    }
+    // Function to pad the payload with zeros up to the next 8-byte boundary
+    void align() {
+        static const unsigned char zeros[8] = { 0 };
+        if (written % 8 != 0) {
+            write(zeros, 8 - written % 8);
+        }
+    }
+    // Function to checksum and write out whatever is in the buffer
+    void flush() {
+        checksum = checksumBlock(checksum, buffer.data(), used);
+        if (used > 0 && fwrite(buffer.data(), 1, used, file) != used) {
+            failed = true;
+        }
+        used = 0;
+    }
+};
+
+// Output formats understood by batch mode (set by --format)
+enum BatchFormat {
+    BATCH_CSV,      // One comma-separated row per result, after a header row
+    BATCH_JSONL     // One JSON object per result
+};
+
+// Define a struct for the buffered writer that batch mode sends its results through
+// Every result is a row tagged with the number of the query that produced it and a kind:
+// a parcel role ("parcel", "cheapest", "lightest", ...), "totals" or "error"
+struct BatchWriter {
+    FILE* file;             // File the results go to, or nullptr to discard them
+    vector<char>* sink;     // Buffer the results are appended to instead of the file, if set
+    BatchFormat format;     // Format of each row
+    vector<char> buffer;    // Rows waiting to be written
+    size_t used;            // Bytes of the buffer in use
+    long long rows;         // Rows written so far
+    long long errors;       // Error rows written so far
+    bool failed;            // True once a write to the file has come up short
+    long long rowLimit;     // Most parcel rows written for one query, or 0 for no limit; the server sets it
+    long long queryRows;    // Parcel rows written for the current query
+    bool truncated;         // True once a parcel row of the current query has been left out for the limit
+    BatchWriter(FILE* f, BatchFormat fmt) : file(f), sink(nullptr), format(fmt), buffer(BATCH_BUFFER_SIZE), used(0), rows(0), errors(0),
+        failed(false), rowLimit(0), queryRows(0), truncated(false) {}
+    ~BatchWriter() {
+        flush();
+    }
+    // Function to append printf-style text, flushing first if it would not fit
+    void append(const char* text, ...) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            va_list args;
+            va_start(args, text);
+            int length = vsnprintf(&buffer[used], buffer.size() - used, text, args);
+            va_end(args);
+            if (length < 0) {
+                return;
+            }
+            if ((size_t)length < buffer.size() - used) {
+                used += length;
+                return;
+            }
+            flush();
+        }
+    }
+    // Function to append a string quoted and escaped for the output format
+    void appendQuoted(const char* text) {
+        append("\"");
+        for (const char* c = text; *c; c++) {
+            if (*c == '"') {
+                append(format == BATCH_CSV ? "\"\"" : "\\\"");
+            }
+            else if (format == BATCH_JSONL && *c == '\\') {
+                append("\\\\");
+            }
+            else if (format == BATCH_JSONL && (unsigned char)*c < 0x20) {
+                append("\\u%04x", (unsigned char)*c);
+            }
+            else {
+                append("%c", *c);
+            }
+        }
+        append("\"");
+    }
+    // Function to start a row with the fields every row has
+    void beginRow(long long query, const char* command, const char* country, const char* kind) {
+        rows++;
+        if (format == BATCH_CSV) {
+            append("%lld,", query);
+            appendQuoted(command);
+            append(",");
+            appendQuoted(country);
+            append(",%s", kind);
+        }
+        else {
+            append("{\"query\":%lld,\"command\":", query);
+            appendQuoted(command);
+            append(",\"country\":");
+            appendQuoted(country);
+            append(",\"kind\":\"%s\"", kind);
+        }
+    }
+    // Function to write the CSV header row; JSON Lines rows name their own fields
+    void writeHeader() {
+        if (format == BATCH_CSV) {
+            append("query,command,country,kind,weight,valuation,count,total_weight,total_valuation,error\n");
+        }
+    }
+    // Function to write one parcel, with 'kind' saying what role it plays in the result
+    // Returns false, writing nothing, once the row limit has been reached
+    bool writeParcel(long long query, const char* command, const char* country, const char* kind, const Parcel* parcel) {
+        if (rowLimit > 0 && queryRows >= rowLimit) {
+            truncated = true;
+            return false;
+        }
+        queryRows++;
+        beginRow(query, command, country, kind);
+        if (format == BATCH_CSV) {
+            append(",%d,%.2f,,,,\n", parcel->weight, centsToAmount(parcel->valuation));
+        }
+        else {
+            append(",\"weight\":%d,\"valuation\":%.2f}\n", parcel->weight, centsToAmount(parcel->valuation));
+        }
+        return true;
+    }
+    // Function to write the count, total load and total valuation of a set of parcels
+    void writeTotals(long long query, const char* command, const char* country, const TotalsAggregate& totals) {
+        beginRow(query, command, country, "totals");
+        if (format == BATCH_CSV) {
+            append(",,,%d,%lld,%.2f,\n", totals.count, totals.totalWeight, centsToAmount(totals.totalValuation));
+        }
+        else {
+            append(",\"count\":%d,\"total_weight\":%lld,\"total_valuation\":%.2f}\n", totals.count, totals.totalWeight, centsToAmount(totals.totalValuation));
+        }
+    }
+    // Function to report a query that could not be answered
+    void writeError(long long query, const char* command, const char* country, const char* message) {
+        errors++;
+        beginRow(query, command, country, "error");
+        if (format == BATCH_CSV) {
+            append(",,,,,,");
+            appendQuoted(message);
+            append("\n");
+        }
+        else {
+            append(",\"error\":");
+            appendQuoted(message);
+            append("}\n");
+        }
+    }
+    // Function to write out whatever is in the buffer; with no file or sink it is thrown away
+    void flush() {
+        if (used > 0 && sink) {
+            sink->insert(sink->end(), buffer.begin(), buffer.begin() + used);
+        }
+        else if (used > 0 && file && fwrite(buffer.data(), 1, used, file) != used) {
+            failed = true;
+        }
+        used = 0;
+    }
+};
+
+// Define a struct for a small, fast pseudo-random number generator
+// It is a 64-bit linear congruential generator returning the high 32 bits of its state,
+// which is plenty for test data and lets every thread own one without locking
+struct RandomGenerator {
+    unsigned long long state;   // Current state; the same seed always gives the same sequence
+    RandomGenerator(unsigned long long seed) : state(seed) {}
+    // Function to return the next 32 random bits
+    unsigned int next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned int)(state >> 32);
+    }
+    // Function to return a random number below 'limit'
+    int below(int limit) {
+        return (int)(next() % (unsigned int)limit);
+    }
+    // Function to return a random number strictly between 0 and 1
+    double uniform() {
+        return (next() + 0.5) / 4294967296.0;
+    }
+};
+
+// Weight distributions --generate can draw parcel weights from (set by --weights)
+enum WeightDistribution {
+    WEIGHTS_UNIFORM,        // Every weight from 1 to GENERATE_MAX_WEIGHT equally likely
+    WEIGHTS_NORMAL,         // Bell curve around the middle of the range
+    WEIGHTS_EXPONENTIAL     // Mostly light parcels with a long tail of heavy ones
+};
+
+// Orders --generate can write rows in (set by --order)
+enum RowOrder {
+    ROWS_RANDOM,            // Rows in the order they are drawn
+    ROWS_SORTED,            // Rows sorted by weight, lightest first
+    ROWS_REVERSED           // Rows sorted by weight, heaviest first
+};
+
+// Define a struct for the shape of the manifest written by --generate
+struct GeneratorOptions {
+    long long rows;                 // Number of parcels to write (--rows)
+    int countries;                  // Number of destination countries (--countries)
+    double skew;                    // Zipf exponent of the country mix, 0 for an even mix (--skew)
+    WeightDistribution weights;     // Distribution of parcel weights (--weights)
+    RowOrder order;                 // Order of the rows in the file (--order)
+    unsigned long long seed;        // Seed of the random number generator (--seed)
+    GeneratorOptions() : rows(100000), countries(20), skew(0), weights(WEIGHTS_UNIFORM), order(ROWS_RANDOM), seed(1) {}
+};
+
+// Define a struct for one reader thread of the stress test
+struct StressReader {
+    HashTable* hashTable;           // Index being read
+    atomic<int>* phase;             // Set by the test: 0 readers alone, 1 during inserts, 2 stop
+    RandomGenerator random;         // The thread's own random number generator
+    vector<float> latencies[2];     // Nanoseconds taken by each totals query, per phase
+    vector<int> loadedCounts;       // Parcel count of each country ID seen before the writer started
+    long long checks;               // Consistency checks made
+    long long failures;             // Consistency checks that failed
+    StressReader() : hashTable(nullptr), phase(nullptr), random(0), checks(0), failures(0) {}
+};
+
+// Define a struct for the state of the thread that follows parcels appended to the manifest
+struct ManifestFollower {
+    const char* path;           // Manifest being followed
+    HashTable* hashTable;       // Index the appended parcels go into
+    int64_t offset;             // Bytes of the manifest read so far, up to and including the last newline
+    vector<char> pending;       // Bytes read past 'offset' that do not make a complete line yet
+    atomic<bool> stopping;      // Set to ask the thread to finish
+    long long followed;         // Parcels inserted from appended lines
+    long long malformed;        // Appended lines skipped as malformed
+    bool notified;              // True when change notifications were available, false when polling
+    ManifestFollower(const char* p, HashTable* h, int64_t o) : path(p), hashTable(h), offset(o), stopping(false), followed(0), malformed(0), notified(false) {}
+};
+
+struct ServerConnection;
+
+// Define a struct for one request line travelling from a server connection to a worker and back
+struct ServerJob {
+    ServerConnection* connection;   // Connection the line came from
+    long long sequence;             // Position of the line among the connection's lines, from 0
+    long long query;                // Number of the query in the result rows, or 0 for a blank line or comment
+    vector<char> line;              // The request line, null-terminated; empty if it was too long
+    vector<char> response;          // Result rows followed by an empty line, filled in by a worker
+    size_t reserved;                // Most bytes the response can take, held against the connection while the job is out
+};
+
+// Define a struct for one client connection of the query server
+// Only the event loop touches it; workers just carry the pointer in their jobs, and the
+// connection is not freed while any of its jobs are still out
+struct ServerConnection {
+    int socket;                     // Non-blocking socket, or -1 once closed
+    size_t index;                   // Position in QueryServer::connections
+    vector<char> input;             // Bytes received that have not been made into jobs yet
+    vector<char> output;            // Responses waiting to be sent, in request order
+    size_t sent;                    // Bytes at the front of 'output' already sent
+    long long nextSequence;         // Sequence number of the next line read
+    long long nextResponse;         // Sequence number of the next response to send
+    long long queries;              // Queries numbered so far, counted as --batch counts them
+    int inFlight;                   // Jobs handed out whose responses are not in 'output' yet
+    size_t held;                    // Bytes reserved for jobs still out, plus finished responses not yet sent
+    vector<ServerJob*> finished;    // Jobs finished ahead of earlier ones, by sequence modulo SERVER_MAX_IN_FLIGHT
+    bool discarding;                // Dropping the rest of a line that was too long
+    bool peerClosed;                // The client will send nothing more
+    bool broken;                    // Sending failed, so responses are dropped and the connection closes once its jobs are back
+    uint32_t events;                // Events the socket is registered for with epoll; 0 when not registered
+    ServerConnection(int s) : socket(s), index(0), sent(0), nextSequence(0), nextResponse(0), queries(0), inFlight(0), held(0),
+        finished(SERVER_MAX_IN_FLIGHT, nullptr), discarding(false), peerClosed(false), broken(false), events(0) {}
+};
+
+// Define a struct for the state shared by the query server's event loop and its worker threads
+struct QueryServer {
+    HashTable* hashTable;                   // Index the queries run against
+    BatchFormat format;                     // Format of the result rows
+    const char* address;                    // Socket path or [host:]port the server listens on
+    int listener;                           // Listening socket
+    int wakeup;                             // eventfd the workers signal when they finish jobs
+    int signals;                            // signalfd reporting SIGINT and SIGTERM
+    int poller;                             // epoll instance the event loop waits on
+    bool allowRemote;                       // Set by --allow-remote to let a TCP server listen beyond 127.0.0.0/8
+    mutex lock;                             // Guards 'queued', 'done' and 'stopping'
+    condition_variable available;           // Signalled when jobs are queued or the server stops
+    deque<ServerJob*> queued;               // Jobs waiting for a worker
+    vector<ServerJob*> done;                // Jobs finished by workers, waiting for the event loop
+    bool stopping;                          // Set to make the workers exit
+    vector<ServerConnection*> connections;  // Open connections
+    vector<ServerConnection*> closed;       // Connections closed during the current round of events, freed after it
+    vector<ServerJob*> spareJobs;           // Finished jobs kept for reuse, so steady traffic allocates nothing
+    vector<ServerJob*> dispatched;          // Jobs made by the event loop, waiting to be queued together
+    long long requests;                     // Lines answered or being answered
+    long long accepted;                     // Connections accepted
+    long long refused;                      // Connections closed at once because SERVER_MAX_CONNECTIONS were open
+    QueryServer(HashTable* h, BatchFormat f) : hashTable(h), format(f), address(nullptr), listener(-1), wakeup(-1),
+        signals(-1), poller(-1), allowRemote(false), stopping(false), requests(0), accepted(0), refused(0) {}
+};
+
+// Define a struct for one connection of the load generator and what it measured
+struct LoadClient {
+    const char* address;                    // Server to connect to
+    const vector<vector<char>>* commands;   // Request lines to send, each ending in a newline
+    size_t firstCommand;                    // Index of the first command this connection sends
+    long long requests;                     // Requests to send
+    int pipeline;                           // Most requests in flight at once
+    LatencyHistogram* latencies;            // Shared histogram of the time from sending each request to reading its response
+    long long rows;                         // Result rows received
+    bool failed;                            // The connection could not be made or broke
+    LoadClient() : address(nullptr), commands(nullptr), firstCommand(0), requests(0), pipeline(1), latencies(nullptr), rows(0), failed(false) {}
+};
+
+// Define a struct for a parcel waiting in its country's run during a bulk load
+struct BulkParcel {
+    int weight;         // Weight of the parcel, which the run is sorted on
+    int64_t valuation;  // Valuation of the parcel, in cents
+};
+
+// Define a struct for the per-country runs of a bulk load, shared by the threads that build the trees
+struct BulkLoad {
+    HashTable* hashTable;               // Table the trees are built into
+    vector<vector<BulkParcel>> runs;    // Parcels for each country ID, in file order until sorted
+    vector<int> order;                  // IDs of the countries with parcels, largest run first
+    atomic<size_t> next;                // Position in 'order' of the next country to build
+    BulkLoad(HashTable* h) : hashTable(h), next(0) {}
+};
+
+// Define a struct for the shape of one country's part of the index, as reported by the stats
+struct CountryShape {
+    int countryId;          // ID of the country in countryDictionary
+    int slot;               // Hash table slot holding the country's entry
+    int probe;              // Slots probed to find the entry: 1 when it sits in its home slot
+    int height;             // Levels in the country's tree
+    bool resident;          // False in lazy mode while the country's parcels are still in its shard
+    long long parcels;      // Parcels the country has, whether loaded or not
+    IndexMemory memory;     // Parcels, nodes and bytes of the tree in memory, none while not resident
+};
+
+// Columns of the fleet report, any of which it can be sorted on
+enum ReportColumn {
+    REPORT_COUNTRY,
+    REPORT_COUNT,
+    REPORT_TOTAL_WEIGHT,
+    REPORT_TOTAL_VALUATION,
+    REPORT_MIN_WEIGHT,
+    REPORT_MAX_WEIGHT,
+    REPORT_MIN_VALUATION,
+    REPORT_MAX_VALUATION,
+    REPORT_COLUMN_COUNT
+};
+
+// Names of the report columns, as given to --report and the menu and used as CSV headers
+const char* reportColumnNames[REPORT_COLUMN_COUNT] = { "country", "count", "total_weight", "total_valuation",
+    "min_weight", "max_weight", "min_valuation", "max_valuation" };
+
+// Define a struct for one country's line of the fleet report
+struct CountryReport {
+    const char* name;       // Name of the country
+    int count;              // Parcels for the country
+    long long totalWeight;  // Sum of their weights
+    int64_t totalValuation; // Sum of their valuations, in cents
+    int minWeight;          // Weight of the lightest parcel
+    int maxWeight;          // Weight of the heaviest parcel
+    int64_t minValuation;   // Valuation of the cheapest parcel, in cents
+    int64_t maxValuation;   // Valuation of the most expensive parcel, in cents
+};
+
+// Define a struct for the share of the countries read by one thread of a fleet report
+struct ReportSlice {
+    HashTable* hashTable;           // Table the entries belong to
+    CountryIndex* const* entries;   // First entry in the slice
+    size_t count;                   // Entries in the slice
+    vector<CountryReport> lines;    // Filled in with a line for each country in the slice that has parcels
+};
+
+// Function prototypes
+
+// Shows the details of all parcels for a given country by searching the hash table
+void showParcelsList(HashTable& hashTable, const char* country);
+
+// Displays parcels for a specific country that meet a weight condition
+// 'higher' determines whether to show parcels heavier or lighter than the specified weight
+void showParcelWeight(HashTable& hashTable, const char* country, int weight, bool higher);
+
+// Displays parcels for a specific country whose weight lies between minWeight and maxWeight, inclusive
+void showParcelRange(HashTable& hashTable, const char* country, int minWeight, int maxWeight);
+
+// Prints one parcel on its own line; used as the visitor for the listing queries
+// Returns true so the traversal carries on
+bool printParcel(Parcel* parcel);
+
+// Calculates and prints the total weight and valuation of all parcels for a country
+// Returns true if the country has parcels, false otherwise
+bool checkTotalLoadAndValuation(HashTable& hashTable, const char* country);
+
+// Displays the cheapest and most expensive parcels for a given country
+void showCost(HashTable& hashTable, const char* country);
+
+// Finds and displays the lightest and heaviest parcels for a specific country
+void lightestAndHeaviest(HashTable& hashTable, const char* country);
+
+// Displays the k cheapest, most expensive and heaviest parcels and the weight percentiles for a country
+void showTopParcels(HashTable& hashTable, const char* country, int k);
+
+// Prints a numbered list of parcels under a heading
+void printParcelList(const char* heading, const vector<Parcel*>& parcels);
+
+// Gathers a report line for every country with parcels, reading the countries on several threads
+vector<CountryReport> collectReport(HashTable& hashTable, int& threadCount);
+
+// Fills in the report lines for one thread's slice of the countries
+void collectReportSlice(ReportSlice& slice);
+
+// Sorts report lines on a column, smallest first unless 'descending' is set
+void sortReport(vector<CountryReport>& lines, ReportColumn column, bool descending);
+
+// Parses a report column name, with a leading '-' for descending order; returns false if it is unknown
+bool parseReportColumn(const char* text, ReportColumn& column, bool& descending);
+
+// Displays the fleet report as a table sorted on a column
+void showReport(HashTable& hashTable, ReportColumn column, bool descending);
+
+// Writes the fleet report to standard output as CSV or JSON Lines, sorted on a column
+bool writeReport(HashTable& hashTable, ReportColumn column, bool descending, BatchFormat format);
+
+// Reads parcel data from a file and adds them to the hash table, setting loadedSize to the bytes read
+// Returns false if the file could not be opened
+bool readFile(HashTable& hashTable, const char* filename, int64_t& loadedSize);
+
+// Writes the whole index to a checksummed binary snapshot tied to the manifest it came from
+bool saveSnapshot(HashTable& hashTable, const char* snapshotPath, int64_t sourceSize, int64_t sourceModified);
+
+// Loads the index from a snapshot, setting loadedSize to the manifest size it covers
+// Returns false if it is missing, damaged or older than the manifest
+bool loadSnapshot(HashTable& hashTable, const char* snapshotPath, const char* sourcePath, int64_t& loadedSize);
+
+// Looks up a file's size and modification time; returns false if it does not exist
+bool getFileInfo(const char* path, int64_t& size, int64_t& modified);
+
+// Adds up a column of weights; the vectorized version is used when the compiler allows it
+long long sumWeights(const int* weights, size_t count);
+long long sumWeightsScalar(const int* weights, size_t count);
+
+// Adds up a column of valuations in cents exactly
+int64_t sumValuations(const int64_t* valuations, size_t count);
+int64_t sumValuationsScalar(const int64_t* valuations, size_t count);
+
+// Finds the positions of the first lowest and first highest valuation in a non-empty column
+void findValuationExtremes(const int64_t* valuations, size_t count, size_t& lowest, size_t& highest);
+void findValuationExtremesScalar(const int64_t* valuations, size_t count, size_t& lowest, size_t& highest);
+
+// Counts the weights in a column that are greater than 'threshold'
+size_t countWeightsAbove(const int* weights, size_t count, int threshold);
+size_t countWeightsAboveScalar(const int* weights, size_t count, int threshold);
+
+// Runs the query commands in a file (or stdin for "-") and writes the results in the given format
+// Returns false if the file could not be opened
+bool runBatch(HashTable& hashTable, const char* path, BatchFormat format);
+
+// Runs one batch command line; returns false if the line was blank or a comment
+bool runBatchQuery(HashTable& hashTable, BatchWriter& writer, long long query, char* line);
+
+// Runs a batch remove or update command, already split into tokens
+void runBatchChange(HashTable& hashTable, BatchWriter& writer, long long query, char** tokens, int tokenCount);
+
+// Times the aggregate queries over Parcel pointers, scalar columns and vectorized columns
+void runColumnBenchmark(HashTable& hashTable);
+
+// Runs reader threads against the index while a writer inserts parcels, checking what the readers see
+// Returns true if every check passed
+bool runStressTest(HashTable& hashTable);
+
+// Body of a stress test reader thread
+void stressReader(StressReader& reader);
+
+// Body of the --follow thread: waits for the manifest to grow and inserts the appended parcels
+void followManifest(ManifestFollower& follower);
+
+// Inserts the parcels on the complete lines appended to the manifest since the follower last read it
+void readAppendedParcels(ManifestFollower& follower);
+
+// Binds the query server to a Unix socket path or a TCP [host:]port and sets up its event loop
+// Returns false if it could not, or if the platform has no epoll
+bool openServer(QueryServer& server, const char* address);
+
+// Answers batch commands from clients of an opened server until SIGINT or SIGTERM, then closes it
+void runServer(QueryServer& server);
+
+// Closes the listening socket and event loop descriptors of a server, removing a Unix socket file
+void closeServer(QueryServer& server);
+
+// Body of a query server worker thread: runs queued request lines and hands back their responses
+void serverWorker(QueryServer& server);
+
+// Opens a listening or connected stream socket for a Unix socket path or a TCP [host:]port
+// Returns the socket, or -1 after printing why it failed
+int openSocket(const char* address, bool listening, bool loopbackOnly);
+
+// Accepts every pending client connection of the query server
+void acceptConnections(QueryServer& server);
+
+// Reads what a client has sent and makes jobs of its complete lines
+void readConnection(QueryServer& server, ServerConnection* connection);
+
+// Makes jobs of a connection's complete request lines, up to its in-flight and output limits, and queues them
+void dispatchLines(QueryServer& server, ServerConnection* connection);
+
+// Returns the most bytes the server's response to a request line can take
+size_t boundResponseSize(const char* begin, const char* end, BatchFormat format);
+
+// Moves the responses finished by the workers into their connections' output, in request order
+void collectFinishedJobs(QueryServer& server);
+
+// Sends as much of a connection's pending output as the socket takes
+void writeConnection(ServerConnection* connection);
+
+// Closes a connection that is finished, or registers it for the events it now waits on
+void updateConnection(QueryServer& server, ServerConnection* connection);
+
+// Sends request lines from a file to a query server over several pipelined connections and
+// prints the request rate and latency percentiles; returns false if it could not
+bool runLoadGenerator(const char* address, const char* commandsPath, int connections, long long requests, int pipeline);
+
+// Body of a load generator connection thread
+void loadClient(LoadClient& client);
+
+// Stops the --follow thread and reports what it inserted
+void stopFollowing(ManifestFollower& follower, thread& followerThread);
+
+// Writes a synthetic manifest with the given number of rows, country mix, weights and order
+// Returns false if the file could not be written
+bool generateManifest(const char* path, const GeneratorOptions& options);
+
+// Draws one parcel weight from the given distribution
+int drawWeight(RandomGenerator& random, WeightDistribution distribution);
+
+// Writes one generated manifest row; returns false if the write failed
+bool writeGeneratedRow(FILE* file, RandomGenerator& random, const vector<double>& cumulative, int weight);
+
+// Prints the load time, memory per parcel and latency percentiles of every menu query
+void runBenchmark(HashTable& hashTable, double loadSeconds);
+
+// Parses a numeric command line value; returns false if it is not a number between minimum and maximum
+bool parseNumberOption(const char* text, double minimum, double maximum, double& value);
+
+// Prints the command line options
+void printUsage(const char* program);
+
+// Gathers the height, node counts and memory of every country's tree, in hash table slot order
+vector<CountryShape> collectIndexShape(HashTable& hashTable, size_t& slotCount);
+
+// Displays operation latencies, hash table probe lengths and tree shapes
+void showStats(HashTable& hashTable);
+
+// Writes the statistics shown by showStats to a JSON file; returns false if it could not be written
+bool dumpStats(HashTable& hashTable, const char* path);
+
+// Prints the index's memory use per parcel next to the cost of one heap block per object
+void reportMemoryUsage(HashTable& hashTable);
+
+// Writes every country's parcels to shard files in a directory, with an index of where each country is
+// Returns false if the directory or any file could not be written
+bool partitionManifest(HashTable& hashTable, const char* directory, int shardCount);
+
+// Reads the first line of a shard index; returns false unless it is a current version index
+bool readShardIndexHeader(FILE* file, ShardIndexHeader& header);
+
+// Removes the shard files of one generation that a partitioning into fileCount shards may have written
+void removeShardFiles(const char* directory, long long generation, int fileCount);
+
+// Reads the index of a partitioned manifest and sets the hash table up to load each country on first use
+// Returns false if the index could not be read
+bool openShards(HashTable& hashTable, const char* directory, double budgetMegabytes);
+
+// Creates a directory unless it already exists; returns false if it could not
+bool makeDirectory(const char* path);
+
+// Estimates the heap space taken by one allocation of the given size, including overhead
+size_t heapBlockSize(size_t bytes);
+
+// Parses every line of a manifest slice into chunk.records, counting malformed lines
+void parseChunk(LoadChunk& chunk);
+
+// Parses a manifest slice and looks up the dictionary ID of every record's country
+void prepareChunk(LoadChunk& chunk);
+
+// Body of a bulk load build thread: sorts country runs by weight and builds their trees from them
+void buildCountryTrees(BulkLoad& load);
+
+// Parses one manifest line of the form "country weight valuation" into 'record'
+// Returns false if the line is malformed
+bool parseParcelLine(const char* line, const char* end, ParcelRecord& record);
+
+// Parses a whole token as a signed integer weight; returns false on bad characters or overflow
+bool parseWeight(const char* begin, const char* end, int& weight);
+
+// Parses a whole token as a decimal valuation such as 12.50 into cents
+// Returns false on bad characters or a value too large to hold in cents
+bool parseValuation(const char* begin, const char* end, int64_t& valuation);
+
+// Prompts the user for input with a given prompt and stores it in 'buffer'
+// Removes any trailing newline characters from the input
+void getUserInput(const char* prompt, char* buffer, int size);
+
+int main(int argc, char* argv[]) {
+    // Check the command line for the optional query modes
+    bool benchmarkColumns = false;
+    bool useSnapshot = true;
+    bool stressTest = false;
+    bool follow = false;
+    bool benchmark = false;
+    const char* statsPath = nullptr;
+    const char* batchPath = nullptr;
+    BatchFormat batchFormat = BATCH_CSV;
+    bool report = false;
+    ReportColumn reportColumn = REPORT_COUNTRY;
+    bool reportDescending = false;
+    const char* manifest = "couriers.txt";
+    const char* generatePath = nullptr;
+    GeneratorOptions generator;
+    const char* serveAddress = nullptr;
+    bool allowRemote = false;
+    const char* loadAddress = nullptr;
+    const char* loadCommands = nullptr;
+    int loadConnections = LOADGEN_CONNECTIONS;
+    int loadPipeline = LOADGEN_PIPELINE;
+    long long loadRequests = LOADGEN_REQUESTS;
+    const char* partitionPath = nullptr;
+    int shardCount = 0;
+    const char* lazyPath = nullptr;
+    double memoryBudget = LAZY_MEMORY_BUDGET_MB;
+    double number;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--columnar") == 0) {
+            columnarQueries = true;
+        }
+        else if (strcmp(argv[i], "--bench-columns") == 0) {
+            benchmarkColumns = true;
+        }
+        else if (strcmp(argv[i], "--no-snapshot") == 0) {
+            useSnapshot = false;
+        }
+        else if (strcmp(argv[i], "--follow") == 0) {
+            follow = true;
+        }
+        else if (strcmp(argv[i], "--stress") == 0) {
+            stressTest = true;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && strcmp(argv[i + 1], "csv") == 0) {
+            batchFormat = BATCH_CSV;
+            i++;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && strcmp(argv[i + 1], "jsonl") == 0) {
+            batchFormat = BATCH_JSONL;
+            i++;
+        }
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc && parseReportColumn(argv[i + 1], reportColumn, reportDescending)) {
+            report = true;
+            i++;
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serveAddress = argv[++i];
+        }
+        else if (strcmp(argv[i], "--allow-remote") == 0) {
+            allowRemote = true;
+        }
+        else if (strcmp(argv[i], "--loadgen") == 0 && i + 2 < argc) {
+            loadAddress = argv[++i];
+            loadCommands = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, 1024, number)) {
+            loadConnections = (int)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, SERVER_MAX_IN_FLIGHT, number)) {
+            loadPipeline = (int)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, 1e12, number)) {
+            loadRequests = (long long)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--partition") == 0 && i + 1 < argc) {
+            partitionPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, 99999, number)) {
+            shardCount = (int)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--lazy") == 0 && i + 1 < argc) {
+            lazyPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, 1e7, number)) {
+            memoryBudget = number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            statsEnabled = true;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            statsEnabled = true;
+            statsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+        }
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        }
+        else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generatePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, GENERATE_MAX_ROWS, number)) {
+            generator.rows = (long long)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--countries") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 1, GENERATE_MAX_COUNTRIES, number)) {
+            generator.countries = (int)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--skew") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 0, 10, number)) {
+            generator.skew = number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc && parseNumberOption(argv[i + 1], 0, 1e15, number)) {
+            generator.seed = (unsigned long long)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc && strcmp(argv[i + 1], "uniform") == 0) {
+            generator.weights = WEIGHTS_UNIFORM;
+            i++;
+        }
+        else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc && strcmp(argv[i + 1], "normal") == 0) {
+            generator.weights = WEIGHTS_NORMAL;
+            i++;
+        }
+        else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc && strcmp(argv[i + 1], "exponential") == 0) {
+            generator.weights = WEIGHTS_EXPONENTIAL;
+            i++;
+        }
+        else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc && strcmp(argv[i + 1], "random") == 0) {
+            generator.order = ROWS_RANDOM;
+            i++;
+        }
+        else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc && strcmp(argv[i + 1], "sorted") == 0) {
+            generator.order = ROWS_SORTED;
+            i++;
+        }
+        else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc && strcmp(argv[i + 1], "reversed") == 0) {
+            generator.order = ROWS_REVERSED;
+            i++;
+        }
+        else {
+            printf("Unknown option or bad value: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (generatePath) {
+        return generateManifest(generatePath, generator) ? 0 : 1;
+    }
+    if (loadAddress) {
+        return runLoadGenerator(loadAddress, loadCommands, loadConnections, loadRequests, loadPipeline) ? 0 : 1;
+    }
+    if (lazyPath && (follow || partitionPath)) {
+        printf("--lazy cannot be combined with %s, which needs the whole manifest loaded\n", follow ? "--follow" : "--partition");
+        return 1;
+    }
+    if (batchPath || report) {
+        statusOutput = stderr;
+    }
+
+    // Create a hash table to store parcels
+    HashTable hashTable;
+
+    // The server is set up before the load, so a bad or busy address is reported before a long load,
+    // and before any loader thread starts, so that every thread has Ctrl+C blocked
+    bool runsInstead = benchmark || benchmarkColumns || stressTest || batchPath || report || partitionPath;
+    QueryServer server(&hashTable, batchFormat);
+    server.allowRemote = allowRemote;
+    if (serveAddress && !runsInstead && !openServer(server, serveAddress)) {
+        return 1;
+    }
+
+    // Start from the snapshot of the manifest's index when there is an up-to-date one;
+    // otherwise read parcel data from the file itself and snapshot the result for next time
+    chrono::steady_clock::time_point loadStart = chrono::steady_clock::now();
+    char snapshot[FILENAME_MAX];
+    snprintf(snapshot, sizeof(snapshot), "%s.snapshot", manifest);
+    int64_t loadedSize = 0;
+    int64_t sourceSize = 0, sourceModified = 0;
+    bool saveWanted = false;
+    if (lazyPath) {
+        if (!openShards(hashTable, lazyPath, memoryBudget)) {
+            if (serveAddress && !runsInstead) {
+                closeServer(server);
+            }
+            return 1;
+        }
+    }
+    else if (!useSnapshot || !loadSnapshot(hashTable, snapshot, manifest, loadedSize)) {
+        // Look at the manifest before reading it, so an edit made during the load leaves a
+        // snapshot that no longer matches the file instead of one that hides the edit
+        bool sourceKnown = getFileInfo(manifest, sourceSize, sourceModified);
+        // A manifest read only up to an unfinished last line is not snapshotted, since the
+        // snapshot is taken to cover the whole file
+        saveWanted = readFile(hashTable, manifest, loadedSize) && useSnapshot && sourceKnown && loadedSize == sourceSize;
+    }
+    double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count();
+    // The snapshot is written after the load is timed, so --benchmark does not count it as loading
+    if (saveWanted) {
+        saveSnapshot(hashTable, snapshot, sourceSize, sourceModified);
+    }
+
+    // The non-interactive modes run instead of the menu
+    int status = -1;
+    if (benchmark) {
+        runBenchmark(hashTable, loadSeconds);
+        status = 0;
+    }
+    else if (benchmarkColumns) {
+        runColumnBenchmark(hashTable);
+        status = 0;
+    }
+    else if (stressTest) {
+        status = runStressTest(hashTable) ? 0 : 1;
+    }
+    else if (batchPath) {
+        status = runBatch(hashTable, batchPath, batchFormat) ? 0 : 1;
+    }
+    else if (report) {
+        status = writeReport(hashTable, reportColumn, reportDescending, batchFormat) ? 0 : 1;
+    }
+    else if (partitionPath) {
+        status = partitionManifest(hashTable, partitionPath, shardCount) ? 0 : 1;
+    }
+    if (status >= 0) {
+        if (statsPath && !dumpStats(hashTable, statsPath)) {
+            status = 1;
+        }
+        return status;
+    }
+
+    // In follow mode, parcels appended to the manifest are inserted in the background while the menu or server runs
+    ManifestFollower follower(manifest, &hashTable, loadedSize);
+    thread followerThread;
+    if (follow) {
+        followerThread = thread(followManifest, ref(follower));
+    }
+
+    if (serveAddress) {
+        runServer(server);
+        if (follow) {
+            stopFollowing(follower, followerThread);
+        }
+        return statsPath && !dumpStats(hashTable, statsPath) ? 1 : 0;
+    }
+
+    // Variable to store user choice from the menu
+    int choice;
+    char country[MAX_COUNTRY_NAME_LENGTH + 2];  // Room for the newline and null terminator left by fgets
+    char input[100];
+    // Variable to store the weight 
+    int weight;
+
+    do {
+        // Display the user menu with options
+        printf("\nUser Menu:\n");
+        printf("----------\n");
+        printf("1. Enter country name and display all the parcels details\n");
+        printf("2. Enter country and weight pair\n");
+        printf("3. Display the total parcel load and valuation for the country\n");
+        printf("4. Enter the country name and display cheapest and most expensive parcel’s details\n");
+        printf("5. Enter the country name and display lightest and heaviest parcel for the country\n");
+        printf("6. Exit the application\n");
+        printf("7. Display operation statistics and index shape\n");
+        printf("8. Enter the country name and K to display the top K parcels and weight percentiles\n");
+        printf("9. Display a report of every country, sorted by a column\n");
+        printf("\n");
+        printf("Enter your choice: ");
+
+        // Get the user's choice from the menu
+        fgets(input, sizeof(input), stdin);
+        sscanf_s(input, "%d", &choice);
+
+        switch (choice) {
+        case 1:
+            // Case 1: Display all parcel details for a given country
+            getUserInput("Enter country name: ", country, sizeof(country));
+            showParcelsList(hashTable, country);// Call function to display all parcels for the given country
+
+            break;
+        case 2:
+            // Case 2: Display parcels for a country based on weight condition
+        {
+            // Prompt for the country name
+            getUserInput("Enter country name: ", country, sizeof(country));
+
+            // Make sure the country has parcels before asking for the weight
+            if (!hashTable.getTree(country)) {
+                // If no parcels were found for the country, display an error message and exit the case
+                printf("\n");
+                printf("Invalid country name or no parcels found for country %s.\n", country);
+                break;
+            }
+
+            // Prompt for the weight to compare
+            printf("Enter the weight to compare: ");
+            fgets(input, sizeof(input), stdin);
+            sscanf_s(input, "%d", &weight);
+
+            // Prompt the user to enter the weight for comparison
+            char conditionChar;
+            do {
+                printf("Enter 'H' for weight higher, 'L' for weight lower or 'R' for a weight range: ");
+                fgets(input, sizeof(input), stdin);
+                conditionChar = toupper(input[0]);
+
+                if (conditionChar != 'H' && conditionChar != 'L' && conditionChar != 'R') {
+                    // If the user enters an invalid choice, display an error message
+                    printf("\n");
+                    printf("Invalid input. Please enter 'H' for higher, 'L' for lower or 'R' for range.\n");
+                }
+            } while (conditionChar != 'H' && conditionChar != 'L' && conditionChar != 'R');
+
+            if (conditionChar == 'R') {
+                // For a range the weight entered above is the lower end, so ask for the upper end
+                int maxWeight;
+                printf("Enter the upper weight of the range: ");
+                fgets(input, sizeof(input), stdin);
+                sscanf_s(input, "%d", &maxWeight);
+                showParcelRange(hashTable, country, weight, maxWeight);
+                break;
+            }
+
+            // Determine the condition based on user input
+            bool condition = (conditionChar == 'H');
+
+            // Call the showParcelWeight function
+            showParcelWeight(hashTable, country, weight, condition);
+            break;
+        }
+
+        case 3:
+            // Case 3: Display the total parcel load and valuation for a given country
+            getUserInput("Enter country name: ", country, sizeof(country));
+
+            // Check if the country has valid parcels
+            if (!checkTotalLoadAndValuation(hashTable, country)) {
+                // If no parcels are found for the country, display an error message
+                printf("\n");
+                printf("Invalid country, please try again.\n");
+            }
+            break;
+        case 4:
+            // Case 4: Display the cheapest and most expensive parcels for a given country
+            getUserInput("Enter country name: ", country, sizeof(country));
+            showCost(hashTable, country);
+            break;
+        case 5:
+            // Case 5: Display the lightest and heaviest parcels for a given country
+            getUserInput("Enter country name: ", country, sizeof(country));
+            lightestAndHeaviest(hashTable, country);
+            break;
+        case 6:
+            // Case 6: Exit the application
+            printf("\n");
+            printf("Exiting the application.\n");
+            break;
+        case 7:
+            // Case 7: Display the operation latencies and the shape of the hash table and trees
+            showStats(hashTable);
+            break;
+        case 8:
+        {
+            // Case 8: Display the K cheapest, most expensive and heaviest parcels and the weight percentiles
+            getUserInput("Enter country name: ", country, sizeof(country));
+            int k = 0;
+            printf("Enter K, the number of parcels to list: ");
+            fgets(input, sizeof(input), stdin);
+            if (sscanf_s(input, "%d", &k) != 1 || k < 1) {
+                printf("\n");
+                printf("K must be a whole number of at least 1.\n");
+                break;
+            }
+            showTopParcels(hashTable, country, k);
+            break;
+        }
+        case 9:
+        {
+            // Case 9: Display the count, totals and extremes of every country in one report
+            ReportColumn column = REPORT_COUNTRY;
+            bool descending = false;
+            char columnName[64];
+            printf("Sort by country, count, total_weight, total_valuation, min_weight, max_weight,\n");
+            getUserInput("min_valuation or max_valuation (put '-' in front for largest first): ", columnName, sizeof(columnName));
+            if (!parseReportColumn(columnName, column, descending)) {
+                printf("\n");
+                printf("Unknown column %s.\n", columnName);
+                break;
+            }
+            showReport(hashTable, column, descending);
+            break;
+        }
+        default:
+            // Handle invalid menu choices by displaying an error message
+            printf("\n");
+            printf("Invalid choice, please enter a number between 1 and 9.\n");
+            break;
+        }
+    } while (choice != 6); // Continue looping until the user chooses to exit
+
+    if (follow) {
+        stopFollowing(follower, followerThread);
+    }
+    if (statsPath && !dumpStats(hashTable, statsPath)) {
+        return 1;
+    }
+    // Return 0 to indicate successful program termination
+    return 0;
+}
+
+
+/*
+ * FUNCTION    : showParcelsList
+ * DESCRIPTION : Displays all parcels for a given country by walking the
+ *               binary search tree associated with that country in the hash
+ *               table, lightest first.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ */
+void showParcelsList(HashTable& hashTable, const char* country) {
+    OperationTimer timer(OP_LIST);
+    // Retrieve the binary search tree associated with the given country
+    TreeReader tree = hashTable.getTree(country);
+
+    if (tree) {
+        // The tree only holds this country's parcels, so every one of them is displayed
+        VisitAggregate<bool (*)(Parcel*)> listing(printParcel);
+        tree->query(INT_MIN, INT_MAX, listing);
+
+        // If no parcels were found for the country, notify the user
+        if (listing.visited == 0) {
+            printf("No parcels found for country %s\n", country);
+        }
+    }
+    else {
+        // If the tree for the specified country is not found, notify the user
+        printf("No parcels found for country %s\n", country);
+    }
+}
+
+/*
+ * FUNCTION    : showParcelWeight
+ * DESCRIPTION : Displays parcels for a given country based on a weight
+ *               condition. The function can filter parcels that are either
+ *               heavier or lighter than the specified weight. The tree is
+ *               searched for the boundary, so lighter or heavier parcels that
+ *               cannot match are never visited.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ *               int weight           - The weight to compare against.
+ *               bool higher          - If true, shows parcels heavier than
+ *                                      the specified weight; otherwise, shows
+ *                                      parcels lighter than the specified weight.
+ */
+void showParcelWeight(HashTable& hashTable, const char* country, int weight, bool higher) {
+    OperationTimer timer(higher ? OP_HEAVIER : OP_LIGHTER);
+    TreeReader tree = hashTable.getTree(country);
+
+    if (tree) {
+        VisitAggregate<bool (*)(Parcel*)> listing(printParcel);
+        printf("\n");
+        if (higher && weight < INT_MAX) {
+            // Jump straight to the first parcel heavier than the weight and print to the end
+            tree->query(weight + 1, INT_MAX, listing);
+        }
+        else if (!higher && weight > INT_MIN) {
+            // Print from the lightest parcel until the weight is reached
+            tree->query(INT_MIN, weight - 1, listing);
+        }
+
+        if (listing.visited == 0) {
+            printf("No parcels %s than %d found for country %s.\n", higher ? "heavier" : "lighter", weight, country);
+        }
+    }
+    else {
+        printf("\n");
+        printf("No parcels found for country %s.\n", country);
+    }
+}
+
+/*
+ * FUNCTION    : showParcelRange
+ * DESCRIPTION : Displays parcels for a given country whose weight lies in
+ *               the range [minWeight, maxWeight], followed by their count,
+ *               total load and total valuation. Only the leaves that hold
+ *               matching parcels are visited, and the parcels are printed
+ *               and totalled in the same pass.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ *               int minWeight        - Lightest weight to include.
+ *               int maxWeight        - Heaviest weight to include.
+ */
+void showParcelRange(HashTable& hashTable, const char* country, int minWeight, int maxWeight) {
+    OperationTimer timer(OP_RANGE);
+    TreeReader tree = hashTable.getTree(country);
+
+    if (tree) {
+        // The totals are added up in the same pass that prints the parcels
+        VisitAggregate<bool (*)(Parcel*)> listing(printParcel);
+        TotalsAggregate totals;
+        printf("\n");
+        tree->query(minWeight, maxWeight, listing, totals);
+
+        if (totals.count == 0) {
+            printf("No parcels between %d and %d found for country %s.\n", minWeight, maxWeight, country);
+        }
+        else {
+            printf("\n");
+            printf("Parcels in range: %d, Total load: %lld, Total valuation: %.2f\n", totals.count, totals.totalWeight, centsToAmount(totals.totalValuation));
+        }
+    }
+    else {
+        printf("\n");
+        printf("No parcels found for country %s.\n", country);
+    }
+}
+
+/*
+ * FUNCTION    : printParcel
+ * DESCRIPTION : Prints one parcel's destination, weight and valuation. The
+ *               listing queries run it through a VisitAggregate, so parcels
+ *               are streamed straight from the leaves.
+ * PARAMETERS  : Parcel* parcel - The parcel to print.
+ * RETURNS     : bool - Always true, so the traversal visits every parcel.
+ */
+bool printParcel(Parcel* parcel) {
+    printf("Destination:%s,Weight:%d,Valuation:%.2f\n", countryDictionary.name(parcel->countryId), parcel->weight, centsToAmount(parcel->valuation));
+    return true;
+}
+
+/*
+ * FUNCTION    : checkTotalLoadAndValuation
+ * DESCRIPTION : Calculates and displays the total load (weight) and total
+ *               valuation of all parcels for a specified country. The totals
+ *               are read from the summary kept at the root of the tree, or
+ *               added up from the country's columns in columnar mode.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ * RETURNS     : bool - Returns true if the country has parcels; false otherwise.
+ */
+bool checkTotalLoadAndValuation(HashTable& hashTable, const char* country) {
+    OperationTimer timer(OP_TOTALS);
+    long long totalWeight = 0;
+    int64_t totalValuation = 0;
+    bool found = false;
+    if (columnarQueries) {
+        // Add up the weight and valuation columns with the vectorized kernels
+        ColumnsReader columns = hashTable.getColumns(country);
+        if (columns && !columns->weights.empty()) {
+            totalWeight = sumWeights(columns->weights.data(), columns->weights.size());
+            totalValuation = sumValuations(columns->valuations.data(), columns->valuations.size());
+            found = true;
+        }
+    }
+    else {
+        TreeReader tree = hashTable.getTree(country);
+        if (tree) {
+            TotalsAggregate totals;
+            tree->query(INT_MIN, INT_MAX, totals);
+            totalWeight = totals.totalWeight;
+            totalValuation = totals.totalValuation;
+            found = totals.count > 0;
+        }
+    }
+
+    if (found) {
+        printf("\n");
+        printf("Total parcel load for country %s: %lld\n", country, totalWeight);
+        printf("\n");
+        printf("Total parcel valuation for country %s: %.2f\n", country, centsToAmount(totalValuation));
+        return true;
+    }
+
+    return false; // Return false if no parcels found for the country
+}
+
+/*
+ * FUNCTION    : showCost
+ * DESCRIPTION : Displays the details of the cheapest and most expensive
+ *               parcels for a given country. Both are tracked in the summary
+ *               kept at the root of the tree, so no parcels are scanned; in
+ *               columnar mode the valuation column is scanned instead.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ */
+void showCost(HashTable& hashTable, const char* country) {
+    OperationTimer timer(OP_COST);
+    Parcel* cheapest = nullptr;
+    Parcel* mostExpensive = nullptr;
+    if (columnarQueries) {
+        // Scan the valuation column with the vectorized kernel
+        ColumnsReader columns = hashTable.getColumns(country);
+        if (columns && !columns->valuations.empty()) {
+            size_t lowest, highest;
+            findValuationExtremes(columns->valuations.data(), columns->valuations.size(), lowest, highest);
+            cheapest = columns->parcels[lowest];
+            mostExpensive = columns->parcels[highest];
+        }
+    }
+    else {
+        TreeReader tree = hashTable.getTree(country);
+        if (tree) {
+            CheapestAggregate cheapestQuery;
+            MostExpensiveAggregate mostExpensiveQuery;
+            tree->query(INT_MIN, INT_MAX, cheapestQuery, mostExpensiveQuery);
+            cheapest = cheapestQuery.cheapest;
+            mostExpensive = mostExpensiveQuery.mostExpensive;
+        }
+    }
+
+    if (cheapest) {
+        printf("\n");
+        printf("Cheapest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, countryDictionary.name(cheapest->countryId), cheapest->weight, centsToAmount(cheapest->valuation));
+        printf("\n");
+        printf("Most expensive parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, countryDictionary.name(mostExpensive->countryId), mostExpensive->weight, centsToAmount(mostExpensive->valuation));
+    }
+    else {
+        printf("\n");
+        printf("No parcels found for country %s\n", country);
+    }
+}
+
+/*
+ * FUNCTION    : lightestAndHeaviest
+ * DESCRIPTION : Displays the details of the lightest and heaviest parcels for
+ *               a given country. The lightest parcel starts the first leaf;
+ *               the heaviest is the first parcel with the largest weight,
+ *               found with a single descent of the tree (or a binary search
+ *               of the weight column in columnar mode).
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ */
+void lightestAndHeaviest(HashTable& hashTable, const char* country) {
+    OperationTimer timer(OP_EXTREMES);
+    Parcel* lightest = nullptr;
+    Parcel* heaviest = nullptr;
+    if (columnarQueries) {
+        // The weight column is sorted, so both ends are known without a scan
+        ColumnsReader columns = hashTable.getColumns(country);
+        if (columns && !columns->weights.empty()) {
+            int count = (int)columns->weights.size();
+            lightest = columns->parcels[0];
+            heaviest = columns->parcels[lowerBound(columns->weights.data(), count, columns->weights[count - 1])];
+        }
+    }
+    else {
+        TreeReader tree = hashTable.getTree(country);
+        if (tree) {
+            LightestAggregate lightestQuery;
+            HeaviestAggregate heaviestQuery;
+            tree->query(INT_MIN, INT_MAX, lightestQuery, heaviestQuery);
+            lightest = lightestQuery.lightest;
+            heaviest = heaviestQuery.heaviest;
+        }
+    }
+
+    if (lightest) {
+        printf("\n");
+        printf("Lightest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, countryDictionary.name(lightest->countryId), lightest->weight, centsToAmount(lightest->valuation));
+        printf("\n");
+        printf("Heaviest parcel for country %s: Destination: %s, Weight: %d, Valuation: %.2f\n", country, countryDictionary.name(heaviest->countryId), heaviest->weight, centsToAmount(heaviest->valuation));
+    }
+    else {
+        printf("\n");
+        printf("No parcels found for country %s\n", country);
+    }
+}
+
+/*
+ * FUNCTION    : showTopParcels
+ * DESCRIPTION : Displays the k cheapest, k most expensive and k heaviest
+ *               parcels for a given country, then its p50, p95 and p99
+ *               weights. The valuation lists come from a best-first search
+ *               of the subtree summaries, the heaviest from the end of the
+ *               leaf chain, and each percentile from a single descent
+ *               steered by the subtree counts, so none of them sorts or
+ *               scans the country's parcels.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* country  - The name of the country to look up.
+ *               int k                - How many parcels to list in each group.
+ */
+void showTopParcels(HashTable& hashTable, const char* country, int k) {
+    OperationTimer timer(OP_TOP_K);
+    TreeReader tree = hashTable.getTree(country);
+    if (!tree || !tree->root) {
+        printf("\n");
+        printf("No parcels found for country %s\n", country);
+        return;
+    }
+
+    char heading[MAX_COUNTRY_NAME_LENGTH + 64];
+    vector<Parcel*> parcels;
+    tree->topByValuation(k, false, parcels);
+    snprintf(heading, sizeof(heading), "Cheapest %d parcel(s) for country %s:", (int)parcels.size(), country);
+    printParcelList(heading, parcels);
+    tree->topByValuation(k, true, parcels);
+    snprintf(heading, sizeof(heading), "Most expensive %d parcel(s) for country %s:", (int)parcels.size(), country);
+    printParcelList(heading, parcels);
+    tree->heaviest(k, parcels);
+    snprintf(heading, sizeof(heading), "Heaviest %d parcel(s) for country %s:", (int)parcels.size(), country);
+    printParcelList(heading, parcels);
+
+    printf("\n");
+    printf("Weight percentiles for country %s: p50 %d, p95 %d, p99 %d\n", country,
+        tree->percentile(0.50)->weight, tree->percentile(0.95)->weight, tree->percentile(0.99)->weight);
+}
+
+/*
+ * FUNCTION    : printParcelList
+ * DESCRIPTION : Prints a heading followed by a numbered list of parcels.
+ * PARAMETERS  : const char* heading              - The line printed above the list.
+ *               const vector<Parcel*>& parcels   - The parcels, in the order to print them.
+ */
+void printParcelList(const char* heading, const vector<Parcel*>& parcels) {
+    printf("\n");
+    printf("%s\n", heading);
+    for (size_t i = 0; i < parcels.size(); i++) {
+        printf("%zu. Destination:%s,Weight:%d,Valuation:%.2f\n", i + 1, countryDictionary.name(parcels[i]->countryId),
+            parcels[i]->weight, centsToAmount(parcels[i]->valuation));
+    }
+}
+
+/*
+ * FUNCTION    : collectReport
+ * DESCRIPTION : Builds the fleet report: one line per country with its parcel
+ *               count, total load, total valuation and lightest, heaviest,
+ *               cheapest and most expensive parcel. Every figure comes from
+ *               the summary at the root of the country's tree and the two
+ *               ends of its leaf chain, so no parcels are visited. The
+ *               countries are split into slices that are read on separate
+ *               threads once there are enough of them to be worth it.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               int& threadCount     - Receives the number of threads used.
+ * RETURNS     : vector<CountryReport> - The report lines, in no particular order.
+ */
+vector<CountryReport> collectReport(HashTable& hashTable, int& threadCount) {
+    // Entries never move or go away, so a copy of the list can be read without the table lock
+    vector<CountryIndex*> entries;
+    {
+        shared_lock<ReadWriteLock> guard(hashTable.lock);
+        entries = hashTable.entries;
+    }
+    size_t sliceCount = thread::hardware_concurrency();
+    if (sliceCount == 0) {
+        sliceCount = 1;
+    }
+    if (sliceCount > entries.size() / REPORT_COUNTRIES_PER_THREAD + 1) {
+        sliceCount = entries.size() / REPORT_COUNTRIES_PER_THREAD + 1;
+    }
+    vector<ReportSlice> slices(sliceCount);
+    for (size_t i = 0; i < sliceCount; i++) {
+        size_t first = entries.size() * i / sliceCount;
+        slices[i].hashTable = &hashTable;
+        slices[i].entries = entries.data() + first;
+        slices[i].count = entries.size() * (i + 1) / sliceCount - first;
+    }
+
+    // Read the slices in parallel, with the first one handled on this thread
+    vector<thread> workers;
+    for (size_t i = 1; i < sliceCount; i++) {
+        workers.push_back(thread(collectReportSlice, ref(slices[i])));
+    }
+    collectReportSlice(slices[0]);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    vector<CountryReport> lines;
+    for (size_t i = 0; i < sliceCount; i++) {
+        lines.insert(lines.end(), slices[i].lines.begin(), slices[i].lines.end());
+    }
+    threadCount = (int)sliceCount;
+    return lines;
+}
+
+/*
+ * FUNCTION    : collectReportSlice
+ * DESCRIPTION : Body of a fleet report thread. Reads each country in its
+ *               slice under the country's shared lock and adds a report line
+ *               for every country that has parcels. In lazy mode each country
+ *               is loaded as it is reached, and may be evicted again later.
+ * PARAMETERS  : ReportSlice& slice - The countries to read; receives the lines.
+ */
+void collectReportSlice(ReportSlice& slice) {
+    slice.lines.reserve(slice.count);
+    for (size_t i = 0; i < slice.count; i++) {
+        CountryIndex* entry = slice.entries[i];
+        shared_lock<ReadWriteLock> guard = slice.hashTable->holdResident(entry);
+        BST& tree = entry->tree;
+        if (!tree.root) {
+            continue;
+        }
+        const ParcelSummary& summary = tree.root->summary;
+        CountryReport line;
+        line.name = countryDictionary.name(entry->countryId);
+        line.count = summary.count;
+        line.totalWeight = summary.totalWeight;
+        line.totalValuation = summary.totalValuation;
+        line.minWeight = tree.first().weight();
+        line.maxWeight = tree.last().weight();
+        line.minValuation = summary.cheapest->valuation;
+        line.maxValuation = summary.mostExpensive->valuation;
+        slice.lines.push_back(line);
+    }
+}
+
+/*
+ * FUNCTION    : sortReport
+ * DESCRIPTION : Sorts report lines on any column. Lines that are equal on
+ *               the column keep to country name order, so the report reads
+ *               the same every time.
+ * PARAMETERS  : vector<CountryReport>& lines - The lines to sort.
+ *               ReportColumn column          - The column to sort on.
+ *               bool descending              - Largest first when true.
+ */
+void sortReport(vector<CountryReport>& lines, ReportColumn column, bool descending) {
+    sort(lines.begin(), lines.end(), [column, descending](const CountryReport& a, const CountryReport& b) {
+        // Compare on the column in its own integer type, so totals in cents stay exact:
+        // negative when a comes first in ascending order
+        auto compare = [](int64_t x, int64_t y) {
+            return (x > y) - (x < y);
+        };
+        int order = 0;
+        switch (column) {
+        case REPORT_COUNT:
+            order = compare(a.count, b.count);
+            break;
+        case REPORT_TOTAL_WEIGHT:
+            order = compare(a.totalWeight, b.totalWeight);
+            break;
+        case REPORT_TOTAL_VALUATION:
+            order = compare(a.totalValuation, b.totalValuation);
+            break;
+        case REPORT_MIN_WEIGHT:
+            order = compare(a.minWeight, b.minWeight);
+            break;
+        case REPORT_MAX_WEIGHT:
+            order = compare(a.maxWeight, b.maxWeight);
+            break;
+        case REPORT_MIN_VALUATION:
+            order = compare(a.minValuation, b.minValuation);
+            break;
+        case REPORT_MAX_VALUATION:
+            order = compare(a.maxValuation, b.maxValuation);
+            break;
+        default:
+            break;
+        }
+        if (order == 0) {
+            return strcmp(a.name, b.name) < 0;
+        }
+        return descending ? order > 0 : order < 0;
+    });
+}
+
+/*
+ * FUNCTION    : parseReportColumn
+ * DESCRIPTION : Parses the name of a report column, such as total_weight. A
+ *               leading '-' asks for the largest values first.
+ * PARAMETERS  : const char* text     - The column name.
+ *               ReportColumn& column - Receives the column.
+ *               bool& descending     - Receives whether to sort largest first.
+ * RETURNS     : bool - Returns false if the name is not a report column.
+ */
+bool parseReportColumn(const char* text, ReportColumn& column, bool& descending) {
+    descending = text[0] == '-';
+    if (descending) {
+        text++;
+    }
+    for (int i = 0; i < REPORT_COLUMN_COUNT; i++) {
+        if (strcmp(text, reportColumnNames[i]) == 0) {
+            column = (ReportColumn)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * FUNCTION    : showReport
+ * DESCRIPTION : Displays the fleet report as a table, one row per country,
+ *               sorted on the chosen column, with the fleet's totals and the
+ *               time the report took underneath.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               ReportColumn column  - The column to sort on.
+ *               bool descending      - Largest first when true.
+ */
+void showReport(HashTable& hashTable, ReportColumn column, bool descending) {
+    OperationTimer timer(OP_REPORT);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int threadCount = 0;
+    vector<CountryReport> lines = collectReport(hashTable, threadCount);
+    sortReport(lines, column, descending);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("\n");
+    printf("%-24s %10s %14s %16s %10s %10s %10s %10s\n", "Country", "Parcels", "Total load", "Total valuation",
+        "Min weight", "Max weight", "Min value", "Max value");
+    long long parcels = 0, totalWeight = 0;
+    int64_t totalValuation = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        const CountryReport& line = lines[i];
+        printf("%-24s %10d %14lld %16.2f %10d %10d %10.2f %10.2f\n", line.name, line.count, line.totalWeight,
+            centsToAmount(line.totalValuation), line.minWeight, line.maxWeight, centsToAmount(line.minValuation), centsToAmount(line.maxValuation));
+        parcels += line.count;
+        totalWeight += line.totalWeight;
+        totalValuation += line.totalValuation;
+    }
+    printf("%-24s %10lld %14lld %16.2f\n", "All countries", parcels, totalWeight, centsToAmount(totalValuation));
+    printf("\n");
+    printf("Reported %d countries sorted by %s%s in %.3f s using %d thread(s)\n", (int)lines.size(),
+        reportColumnNames[column], descending ? " (descending)" : "", seconds, threadCount);
+}
+
+/*
+ * FUNCTION    : writeReport
+ * DESCRIPTION : Writes the fleet report to standard output for --report,
+ *               sorted on the chosen column, as CSV under a header row or
+ *               as one JSON object per country. The time taken is reported
+ *               on standard error.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               ReportColumn column  - The column to sort on.
+ *               bool descending      - Largest first when true.
+ *               BatchFormat format   - The format to write the report in.
+ * RETURNS     : bool - Returns false if the report could not all be written.
+ */
+bool writeReport(HashTable& hashTable, ReportColumn column, bool descending, BatchFormat format) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int threadCount = 0;
+    vector<CountryReport> lines;
+    {
+        OperationTimer timer(OP_REPORT);
+        lines = collectReport(hashTable, threadCount);
+        sortReport(lines, column, descending);
+    }
+
+    BatchWriter writer(stdout, format);
+    if (format == BATCH_CSV) {
+        for (int i = 0; i < REPORT_COLUMN_COUNT; i++) {
+            writer.append(i == 0 ? "%s" : ",%s", reportColumnNames[i]);
+        }
+        writer.append("\n");
+    }
+    for (size_t i = 0; i < lines.size(); i++) {
+        const CountryReport& line = lines[i];
+        const char* layout = format == BATCH_CSV ? ",%d,%lld,%.2f,%d,%d,%.2f,%.2f\n" :
+            ",\"count\":%d,\"total_weight\":%lld,\"total_valuation\":%.2f,\"min_weight\":%d,\"max_weight\":%d,\"min_valuation\":%.2f,\"max_valuation\":%.2f}\n";
+        writer.append(format == BATCH_CSV ? "" : "{\"country\":");
+        writer.appendQuoted(line.name);
+        writer.append(layout, line.count, line.totalWeight, centsToAmount(line.totalValuation), line.minWeight, line.maxWeight,
+            centsToAmount(line.minValuation), centsToAmount(line.maxValuation));
+    }
+    writer.flush();
+    if (writer.failed || fflush(stdout) != 0) {
+        fprintf(stderr, "Failed to write the report: %s\n", strerror(errno));
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Reported %d countries sorted by %s%s in %.3f s using %d thread(s)\n", (int)lines.size(),
+        reportColumnNames[column], descending ? " (descending)" : "", seconds, threadCount);
+    return true;
+}
+
+/*
+ * FUNCTION    : sumWeights
+ * DESCRIPTION : Adds up a column of weights into a 64-bit total. Eight (AVX2)
+ *               or four (SSE2) weights are widened and added per step; any
+ *               remainder, or the whole column without vector support, is
+ *               handled by sumWeightsScalar.
+ * PARAMETERS  : const int* weights - The weight column.
+ *               size_t count       - The number of weights in the column.
+ * RETURNS     : long long - The sum of the weights.
+ */
+long long sumWeights(const int* weights, size_t count) {
+    size_t i = 0;
+    long long total = 0;
+#if defined(COLUMN_KERNELS_AVX2)
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (; i + 8 <= count; i += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(weights + i));
+        low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(block)));
+        high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(block, 1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(COLUMN_KERNELS_SSE2)
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(weights + i));
+        __m128i sign = _mm_srai_epi32(block, 31);  // Sign-extend to 64 bits by pairing each weight with its sign
+        low = _mm_add_epi64(low, _mm_unpacklo_epi32(block, sign));
+        high = _mm_add_epi64(high, _mm_unpackhi_epi32(block, sign));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(low, high));
+    total = lanes[0] + lanes[1];
+#endif
+    return total + sumWeightsScalar(weights + i, count - i);
+}
+
+/*
+ * FUNCTION    : sumWeightsScalar
+ * DESCRIPTION : Adds up a column of weights one at a time.
+ * PARAMETERS  : const int* weights - The weight column.
+ *               size_t count       - The number of weights in the column.
+ * RETURNS     : long long - The sum of the weights.
+ */
+long long sumWeightsScalar(const int* weights, size_t count) {
+    long long total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += weights[i];
+    }
+    return total;
+}
+
+/*
+ * FUNCTION    : sumValuations
+ * DESCRIPTION : Adds up a column of valuations in cents. The sum is exact, so
+ *               it can be split across vector lanes in any order. Eight
+ *               (AVX2) or four (SSE2) valuations are added per step in two
+ *               sets of 64-bit lanes; any remainder, or the whole column
+ *               without vector support, is handled by sumValuationsScalar.
+ * PARAMETERS  : const int64_t* valuations - The valuation column.
+ *               size_t count              - The number of valuations in the column.
+ * RETURNS     : int64_t - The sum of the valuations, in cents.
+ */
+int64_t sumValuations(const int64_t* valuations, size_t count) {
+    size_t i = 0;
+    int64_t total = 0;
+#if defined(COLUMN_KERNELS_AVX2)
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (; i + 8 <= count; i += 8) {
+        low = _mm256_add_epi64(low, _mm256_loadu_si256((const __m256i*)(valuations + i)));
+        high = _mm256_add_epi64(high, _mm256_loadu_si256((const __m256i*)(valuations + i + 4)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(COLUMN_KERNELS_SSE2)
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        low = _mm_add_epi64(low, _mm_loadu_si128((const __m128i*)(valuations + i)));
+        high = _mm_add_epi64(high, _mm_loadu_si128((const __m128i*)(valuations + i + 2)));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(low, high));
+    total = lanes[0] + lanes[1];
+#endif
+    return total + sumValuationsScalar(valuations + i, count - i);
+}
+
+/*
+ * FUNCTION    : sumValuationsScalar
+ * DESCRIPTION : Adds up a column of valuations in cents one at a time.
+ * PARAMETERS  : const int64_t* valuations - The valuation column.
+ *               size_t count              - The number of valuations in the column.
+ * RETURNS     : int64_t - The sum of the valuations, in cents.
+ */
+int64_t sumValuationsScalar(const int64_t* valuations, size_t count) {
+    int64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += valuations[i];
+    }
+    return total;
+}
+
+/*
+ * FUNCTION    : findValuationExtremes
+ * DESCRIPTION : Finds the first lowest and first highest valuation in a
+ *               column. With AVX2, one vectorized pass of 64-bit integer
+ *               compares finds the two values and a second pass, which
+ *               usually stops early, finds where each first occurs, matching
+ *               the scalar scan's choice on ties. SSE2 has no 64-bit compare
+ *               and emulating one costs more than it saves, so otherwise the
+ *               scalar scan is used.
+ * PARAMETERS  : const int64_t* valuations - The valuation column; must not be empty.
+ *               size_t count              - The number of valuations in the column.
+ *               size_t& lowest            - Receives the position of the lowest valuation.
+ *               size_t& highest           - Receives the position of the highest valuation.
+ */
+void findValuationExtremes(const int64_t* valuations, size_t count, size_t& lowest, size_t& highest) {
+#if defined(COLUMN_KERNELS_AVX2)
+    size_t i = 0;
+    int64_t low = valuations[0];
+    int64_t high = valuations[0];
+    if (count >= 4) {
+        __m256i lows = _mm256_loadu_si256((const __m256i*)valuations);
+        __m256i highs = lows;
+        for (i = 4; i + 4 <= count; i += 4) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)(valuations + i));
+            lows = _mm256_blendv_epi8(lows, block, _mm256_cmpgt_epi64(lows, block));
+            highs = _mm256_blendv_epi8(highs, block, _mm256_cmpgt_epi64(block, highs));
+        }
+        int64_t lowLanes[4], highLanes[4];
+        _mm256_storeu_si256((__m256i*)lowLanes, lows);
+        _mm256_storeu_si256((__m256i*)highLanes, highs);
+        for (int lane = 0; lane < 4; lane++) {
+            low = lowLanes[lane] < low ? lowLanes[lane] : low;
+            high = highLanes[lane] > high ? highLanes[lane] : high;
+        }
+    }
+    for (; i < count; i++) {
+        low = valuations[i] < low ? valuations[i] : low;
+        high = valuations[i] > high ? valuations[i] : high;
+    }
+
+    // Locate the first occurrence of each extreme
+    lowest = count;
+    highest = count;
+    for (i = 0; i < count && (lowest == count || highest == count); i++) {
+        if (lowest == count && valuations[i] == low) {
+            lowest = i;
+        }
+        if (highest == count && valuations[i] == high) {
+            highest = i;
+        }
+    }
+#else
+    findValuationExtremesScalar(valuations, count, lowest, highest);
+#endif
+}
+
+/*
+ * FUNCTION    : findValuationExtremesScalar
+ * DESCRIPTION : Finds the first lowest and first highest valuation in a
+ *               column with a single scalar pass.
+ * PARAMETERS  : const int64_t* valuations - The valuation column; must not be empty.
+ *               size_t count              - The number of valuations in the column.
+ *               size_t& lowest            - Receives the position of the lowest valuation.
+ *               size_t& highest           - Receives the position of the highest valuation.
+ */
+void findValuationExtremesScalar(const int64_t* valuations, size_t count, size_t& lowest, size_t& highest) {
+    lowest = 0;
+    highest = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (valuations[i] < valuations[lowest]) {
+            lowest = i;
+        }
+        if (valuations[i] > valuations[highest]) {
+            highest = i;
+        }
+    }
+}
+
+/*
+ * FUNCTION    : countWeightsAbove
+ * DESCRIPTION : Counts the weights in a column that are greater than a
+ *               threshold. Each vector compare yields -1 per match, which is
+ *               subtracted from per-lane counters.
+ * PARAMETERS  : const int* weights - The weight column.
+ *               size_t count       - The number of weights in the column.
+ *               int threshold      - The weight to compare against.
+ * RETURNS     : size_t - The number of weights greater than the threshold.
+ */
+size_t countWeightsAbove(const int* weights, size_t count, int threshold) {
+    size_t i = 0;
+    size_t matches = 0;
+#if defined(COLUMN_KERNELS_AVX2)
+    __m256i limit = _mm256_set1_epi32(threshold);
+    __m256i counts = _mm256_setzero_si256();
+    for (; i + 8 <= count; i += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(weights + i));
+        counts = _mm256_sub_epi32(counts, _mm256_cmpgt_epi32(block, limit));
+    }
+    unsigned int lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, counts);
+    for (int lane = 0; lane < 8; lane++) {
+        matches += lanes[lane];
+    }
+#elif defined(COLUMN_KERNELS_SSE2)
+    __m128i limit = _mm_set1_epi32(threshold);
+    __m128i counts = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(weights + i));
+        counts = _mm_sub_epi32(counts, _mm_cmpgt_epi32(block, limit));
+    }
+    unsigned int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, counts);
+    for (int lane = 0; lane < 4; lane++) {
+        matches += lanes[lane];
+    }
+#endif
+    return matches + countWeightsAboveScalar(weights + i, count - i, threshold);
+}
+
+/*
+ * FUNCTION    : countWeightsAboveScalar
+ * DESCRIPTION : Counts the weights in a column that are greater than a
+ *               threshold, one at a time.
+ * PARAMETERS  : const int* weights - The weight column.
+ *               size_t count       - The number of weights in the column.
+ *               int threshold      - The weight to compare against.
+ * RETURNS     : size_t - The number of weights greater than the threshold.
+ */
+size_t countWeightsAboveScalar(const int* weights, size_t count, int threshold) {
+    size_t matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        matches += (weights[i] > threshold);
+    }
+    return matches;
+}
+
+/*
+ * FUNCTION    : runColumnBenchmark
+ * DESCRIPTION : Runs the work behind the total, cost, lightest/heaviest and a
+ *               weight-threshold query for every country three ways: walking
+ *               the tree's Parcel pointers with a cursor (how the tree
+ *               queries work), scalar loops over the columns, and the
+ *               vectorized column kernels. Prints the time per parcel for
+ *               each and checks that all three agree.
+ * PARAMETERS  : HashTable& hashTable - Reference to the loaded hash table.
+ */
+void runColumnBenchmark(HashTable& hashTable) {
+    double pointerSeconds = 0, scalarSeconds = 0, vectorSeconds = 0;
+    long long parcelsScanned = 0, mismatches = 0;
+    double checksum = 0;  // Printed at the end so the compiler cannot drop any of the timed work
+
+    for (int id = 0; id < countryDictionary.count(); id++) {
+        // Read through the hash table, which loads the country in lazy mode and holds its lock
+        TreeReader tree = hashTable.getTree(id);
+        if (!tree) {
+            continue;
+        }
+        CountryColumns columns;
+        columns.build(*tree.tree);
+        size_t count = columns.weights.size();
+        if (count == 0) {
+            continue;
+        }
+        int threshold = columns.weights[count / 2];
+
+        for (int repeat = 0; repeat < COLUMN_BENCHMARK_REPEATS; repeat++) {
+            // Pointer walk: follow each parcel pointer out of the leaves
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            long long pointerWeight = 0;
+            int64_t pointerValuation = 0;
+            size_t pointerAbove = 0;
+            Parcel* cheapest = tree->first().parcel();
+            Parcel* mostExpensive = cheapest;
+            Parcel* heaviest = cheapest;
+            for (ParcelCursor cursor = tree->first(); cursor; cursor.next()) {
+                Parcel* parcel = cursor.parcel();
+                pointerWeight += parcel->weight;
+                pointerValuation += parcel->valuation;
+                pointerAbove += (parcel->weight > threshold);
+                if (parcel->valuation < cheapest->valuation) {
+                    cheapest = parcel;
+                }
+                if (parcel->valuation > mostExpensive->valuation) {
+                    mostExpensive = parcel;
+                }
+                if (parcel->weight > heaviest->weight) {
+                    heaviest = parcel;
+                }
+            }
+            chrono::steady_clock::time_point pointerEnd = chrono::steady_clock::now();
+
+            // Scalar loops over the columns
+            long long scalarWeight = sumWeightsScalar(columns.weights.data(), count);
+            int64_t scalarValuation = sumValuationsScalar(columns.valuations.data(), count);
+            size_t scalarLowest, scalarHighest;
+            findValuationExtremesScalar(columns.valuations.data(), count, scalarLowest, scalarHighest);
+            size_t scalarAbove = countWeightsAboveScalar(columns.weights.data(), count, threshold);
+            chrono::steady_clock::time_point scalarEnd = chrono::steady_clock::now();
+
+            // Vectorized kernels over the columns
+            long long vectorWeight = sumWeights(columns.weights.data(), count);
+            int64_t vectorValuation = sumValuations(columns.valuations.data(), count);
+            size_t vectorLowest, vectorHighest;
+            findValuationExtremes(columns.valuations.data(), count, vectorLowest, vectorHighest);
+            size_t vectorAbove = countWeightsAbove(columns.weights.data(), count, threshold);
+            chrono::steady_clock::time_point vectorEnd = chrono::steady_clock::now();
+
+            pointerSeconds += chrono::duration<double>(pointerEnd - start).count();
+            scalarSeconds += chrono::duration<double>(scalarEnd - pointerEnd).count();
+            vectorSeconds += chrono::duration<double>(vectorEnd - scalarEnd).count();
+            parcelsScanned += (long long)count;
+            checksum += centsToAmount(pointerValuation + scalarValuation + vectorValuation) + heaviest->weight;
+
+            // All three paths must pick the same parcels and agree exactly on the totals
+            if (pointerWeight != scalarWeight || scalarWeight != vectorWeight ||
+                pointerAbove != scalarAbove || scalarAbove != vectorAbove ||
+                cheapest != columns.parcels[scalarLowest] || cheapest != columns.parcels[vectorLowest] ||
+                mostExpensive != columns.parcels[scalarHighest] || mostExpensive != columns.parcels[vectorHighest] ||
+                pointerValuation != scalarValuation || scalarValuation != vectorValuation) {
+                mismatches++;
+            }
+        }
+    }
+
+    if (parcelsScanned == 0) {
+        printf("No parcels loaded, nothing to benchmark.\n");
+        return;
+    }
+#if defined(COLUMN_KERNELS_AVX2)
+    const char* kernels = "AVX2";
+#elif defined(COLUMN_KERNELS_SSE2)
+    const char* kernels = "SSE2";
+#else
+    const char* kernels = "scalar fallback";
+#endif
+    printf("\n");
+    printf("Aggregate queries over %lld parcels (%d repeats per country)\n", parcelsScanned / COLUMN_BENCHMARK_REPEATS, COLUMN_BENCHMARK_REPEATS);
+    printf("%-26s %9.3f ms, %6.2f ns/parcel\n", "Pointer walk:", pointerSeconds * 1e3, pointerSeconds * 1e9 / parcelsScanned);
+    printf("%-26s %9.3f ms, %6.2f ns/parcel, %5.1fx faster\n", "Columns, scalar:", scalarSeconds * 1e3, scalarSeconds * 1e9 / parcelsScanned, pointerSeconds / scalarSeconds);
+    char label[32];
+    snprintf(label, sizeof(label), "Columns, %s:", kernels);
+    printf("%-26s %9.3f ms, %6.2f ns/parcel, %5.1fx faster\n", label, vectorSeconds * 1e3, vectorSeconds * 1e9 / parcelsScanned, pointerSeconds / vectorSeconds);
+    printf("Results %s (checksum %.0f)\n", mismatches == 0 ? "match on every path" : "DIFFER between paths", checksum);
+}
+
+/*
+ * FUNCTION    : runBatch
+ * DESCRIPTION : Runs a file of query commands against the index without any
+ *               prompts, one command per line:
+ *                   list <country>
+ *                   range <country> <min weight> <max weight>
+ *                   heavier <country> <weight>
+ *                   lighter <country> <weight>
+ *                   totals <country>
+ *                   cost <country>
+ *                   extremes <country>
+ *                   cheapest <country> <k>
+ *                   costliest <country> <k>
+ *                   heaviest <country> <k>
+ *                   percentiles <country>
+ *                   remove <country> <weight> <valuation>
+ *                   update <country> <weight> <valuation> <new weight> <new valuation>
+ *               Blank lines and lines starting with '#' are skipped. Results
+ *               go to standard output through a BatchWriter, and the query
+ *               rate is reported on standard error at the end.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* path     - The command file, or "-" for standard input.
+ *               BatchFormat format   - The format to write results in.
+ * RETURNS     : bool - Returns false if the command file could not be opened
+ *               or the results could not all be written.
+ */
+bool runBatch(HashTable& hashTable, const char* path, BatchFormat format) {
+    FILE* input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input) {
+        fprintf(stderr, "Failed to open batch file %s\n", path);
+        return false;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long queries = 0;
+    BatchWriter writer(stdout, format);
+    writer.writeHeader();
+    char line[MAX_COUNTRY_NAME_LENGTH + 100];
+    while (fgets(line, sizeof(line), input)) {
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            // Skip the rest of an overlong line so it is not read as another command
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n') {
+            }
+            writer.writeError(++queries, "", "", "line too long");
+            continue;
+        }
+        if (runBatchQuery(hashTable, writer, queries + 1, line)) {
+            queries++;
+        }
+    }
+    writer.flush();
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (writer.failed || fflush(stdout) != 0) {
+        fprintf(stderr, "Failed to write the batch results: %s\n", strerror(errno));
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Ran %lld queries (%lld rows, %lld errors) in %.3f s: %.0f queries/s\n",
+        queries, writer.rows, writer.errors, seconds, seconds > 0 ? queries / seconds : 0.0);
+    return true;
+}
+
+/*
+ * FUNCTION    : runBatchQuery
+ * DESCRIPTION : Parses one batch command and writes its result rows. When
+ *               the writer has a row limit, parcel rows past it are left out
+ *               and an error row says the result was cut off.
+ * PARAMETERS  : HashTable& hashTable  - Reference to the hash table.
+ *               BatchWriter& writer   - Where the result rows go.
+ *               long long query       - Number identifying this query in the output.
+ *               char* line            - The command line; split in place.
+ * RETURNS     : bool - Returns false if the line was blank or a comment.
+ */
+bool runBatchQuery(HashTable& hashTable, BatchWriter& writer, long long query, char* line) {
+    // Split the line into whitespace-separated tokens
+    char* tokens[6];
+    int tokenCount = 0;
+    for (char* c = line; *c && tokenCount < 6;) {
+        while (*c && isspace((unsigned char)*c)) {
+            c++;
+        }
+        if (!*c) {
+            break;
+        }
+        tokens[tokenCount++] = c;
+        while (*c && !isspace((unsigned char)*c)) {
+            c++;
+        }
+        if (*c) {
+            *c++ = '\0';
+        }
+    }
+    if (tokenCount == 0 || tokens[0][0] == '#') {
+        return false;
+    }
+    writer.queryRows = 0;
+
+    const char* command = tokens[0];
+    const char* country = tokenCount > 1 ? tokens[1] : "";
+    if (strcmp(command, "remove") == 0 || strcmp(command, "update") == 0) {
+        runBatchChange(hashTable, writer, query, tokens, tokenCount);
+        return true;
+    }
+    int expected = 2;
+    Operation operation;
+    if (strcmp(command, "range") == 0) {
+        expected = 4;
+        operation = OP_RANGE;
+    }
+    else if (strcmp(command, "heavier") == 0 || strcmp(command, "lighter") == 0) {
+        expected = 3;
+        operation = command[0] == 'h' ? OP_HEAVIER : OP_LIGHTER;
+    }
+    else if (strcmp(command, "list") == 0) {
+        operation = OP_LIST;
+    }
+    else if (strcmp(command, "totals") == 0) {
+        operation = OP_TOTALS;
+    }
+    else if (strcmp(command, "cost") == 0) {
+        operation = OP_COST;
+    }
+    else if (strcmp(command, "extremes") == 0) {
+        operation = OP_EXTREMES;
+    }
+    else if (strcmp(command, "cheapest") == 0 || strcmp(command, "costliest") == 0 || strcmp(command, "heaviest") == 0) {
+        expected = 3;
+        operation = OP_TOP_K;
+    }
+    else if (strcmp(command, "percentiles") == 0) {
+        operation = OP_PERCENTILES;
+    }
+    else {
+        writer.writeError(query, command, country, "unknown command");
+        return true;
+    }
+    OperationTimer timer(operation);
+    if (tokenCount != expected) {
+        writer.writeError(query, command, country, "wrong number of arguments");
+        return true;
+    }
+    int weights[2] = { 0, 0 };
+    for (int i = 2; i < tokenCount; i++) {
+        if (!parseWeight(tokens[i], tokens[i] + strlen(tokens[i]), weights[i - 2])) {
+            writer.writeError(query, command, country, "weight is not a whole number");
+            return true;
+        }
+    }
+    if (operation == OP_TOP_K && weights[0] < 1) {
+        writer.writeError(query, command, country, "k must be at least 1");
+        return true;
+    }
+    TreeReader tree = hashTable.getTree(country);
+    if (!tree || !tree->root) {
+        writer.writeError(query, command, country, "no parcels found for country");
+        return true;
+    }
+
+    if (strcmp(command, "totals") == 0) {
+        TotalsAggregate totals;
+        tree->query(INT_MIN, INT_MAX, totals);
+        writer.writeTotals(query, command, country, totals);
+    }
+    else if (strcmp(command, "cost") == 0) {
+        CheapestAggregate cheapest;
+        MostExpensiveAggregate mostExpensive;
+        tree->query(INT_MIN, INT_MAX, cheapest, mostExpensive);
+        writer.writeParcel(query, command, country, "cheapest", cheapest.cheapest);
+        writer.writeParcel(query, command, country, "most_expensive", mostExpensive.mostExpensive);
+    }
+    else if (strcmp(command, "extremes") == 0) {
+        LightestAggregate lightest;
+        HeaviestAggregate heaviest;
+        tree->query(INT_MIN, INT_MAX, lightest, heaviest);
+        writer.writeParcel(query, command, country, "lightest", lightest.lightest);
+        writer.writeParcel(query, command, country, "heaviest", heaviest.heaviest);
+    }
+    else if (operation == OP_TOP_K) {
+        vector<Parcel*> parcels;
+        const char* kind = command;
+        if (strcmp(command, "heaviest") == 0) {
+            tree->heaviest(weights[0], parcels);
+        }
+        else {
+            bool costliest = strcmp(command, "costliest") == 0;
+            tree->topByValuation(weights[0], costliest, parcels);
+            kind = costliest ? "most_expensive" : "cheapest";
+        }
+        for (size_t i = 0; i < parcels.size() && writer.writeParcel(query, command, country, kind, parcels[i]); i++) {
+        }
+    }
+    else if (operation == OP_PERCENTILES) {
+        writer.writeParcel(query, command, country, "p50", tree->percentile(0.50));
+        writer.writeParcel(query, command, country, "p95", tree->percentile(0.95));
+        writer.writeParcel(query, command, country, "p99", tree->percentile(0.99));
+    }
+    else {
+        // The listing commands all print a run of parcels between two weights
+        int minWeight = INT_MIN, maxWeight = INT_MAX;
+        if (strcmp(command, "range") == 0) {
+            minWeight = weights[0];
+            maxWeight = weights[1];
+        }
+        else if (strcmp(command, "heavier") == 0) {
+            if (weights[0] == INT_MAX) {
+                return true;
+            }
+            minWeight = weights[0] + 1;
+        }
+        else if (strcmp(command, "lighter") == 0) {
+            if (weights[0] == INT_MIN) {
+                return true;
+            }
+            maxWeight = weights[0] - 1;
+        }
+        // Past the row limit a listing stops, but a range walks on so its totals stay whole
+        bool ranged = strcmp(command, "range") == 0;
+        VisitAggregate listing([&](Parcel* parcel) {
+            return writer.writeParcel(query, command, country, "parcel", parcel) || ranged;
+        });
+        if (ranged) {
+            // A range also reports its totals, which are added up in the same pass
+            TotalsAggregate totals;
+            tree->query(minWeight, maxWeight, listing, totals);
+            writer.writeTotals(query, command, country, totals);
+        }
+        else {
+            tree->query(minWeight, maxWeight, listing);
+        }
+    }
+    if (writer.truncated) {
+        char message[64];
+        snprintf(message, sizeof(message), "result cut off after %lld parcel rows", writer.rowLimit);
+        writer.truncated = false;
+        writer.writeError(query, command, country, message);
+    }
+    return true;
+}
+
+/*
+ * FUNCTION    : runBatchChange
+ * DESCRIPTION : Removes a parcel, or changes its weight and valuation, for a
+ *               batch command. The parcel is picked out by its country,
+ *               weight and valuation; when several match, the first in
+ *               weight order is changed. Writes the parcel as it now is, or
+ *               an error row if there is no such parcel.
+ * PARAMETERS  : HashTable& hashTable  - Reference to the hash table.
+ *               BatchWriter& writer   - Where the result row goes.
+ *               long long query       - Number identifying this query in the output.
+ *               char** tokens         - The command and its arguments.
+ *               int tokenCount        - Number of tokens.
+ */
+void runBatchChange(HashTable& hashTable, BatchWriter& writer, long long query, char** tokens, int tokenCount) {
+    const char* command = tokens[0];
+    const char* country = tokenCount > 1 ? tokens[1] : "";
+    bool removing = strcmp(command, "remove") == 0;
+    if (tokenCount != (removing ? 4 : 6)) {
+        writer.writeError(query, command, country, "wrong number of arguments");
+        return;
+    }
+    // Weights and valuations alternate after the country
+    int weights[2] = { 0, 0 };
+    int64_t valuations[2] = { 0, 0 };
+    for (int i = 2; i < tokenCount; i += 2) {
+        if (!parseWeight(tokens[i], tokens[i] + strlen(tokens[i]), weights[i / 2 - 1])) {
+            writer.writeError(query, command, country, "weight is not a whole number");
+            return;
+        }
+        if (!parseValuation(tokens[i + 1], tokens[i + 1] + strlen(tokens[i + 1]), valuations[i / 2 - 1])) {
+            writer.writeError(query, command, country, "valuation is not a number");
+            return;
+        }
+    }
+    int countryId = countryDictionary.find(country);
+    bool changed = countryId >= 0 && (removing ? hashTable.remove(countryId, weights[0], valuations[0]) :
+        hashTable.update(countryId, weights[0], valuations[0], weights[1], valuations[1]));
+    if (!changed) {
+        writer.writeError(query, command, country, "no such parcel");
+        return;
+    }
+    Parcel parcel(countryId, removing ? weights[0] : weights[1], removing ? valuations[0] : valuations[1]);
+    writer.writeParcel(query, command, country, removing ? "removed" : "updated", &parcel);
+}
+
+/*
+ * FUNCTION    : runStressTest
+ * DESCRIPTION : Checks that queries see a consistent view of each country
+ *               while parcels are being changed. Reader threads first query
+ *               the loaded index on their own, then carry on while a writer
+ *               inserts STRESS_INSERTS parcels into the existing countries
+ *               and into new ones, and removes and updates some of the
+ *               parcels it inserted earlier. The latency of totals queries is reported
+ *               for both phases, so blocking by the writer shows up as a
+ *               jump between them.
+ * PARAMETERS  : HashTable& hashTable - Reference to the loaded hash table.
+ * RETURNS     : bool - Returns true if every consistency check passed.
+ */
+bool runStressTest(HashTable& hashTable) {
+    int existingCountries = countryDictionary.count();
+    if (existingCountries == 0) {
+        printf("No parcels loaded, nothing to stress.\n");
+        return false;
+    }
+    printf("Stress test: %d reader thread(s), %d inserts over %d countries\n", STRESS_READER_THREADS, STRESS_INSERTS, existingCountries);
+
+    atomic<int> phase(0);
+    vector<StressReader> readers(STRESS_READER_THREADS);
+    vector<thread> workers;
+    for (int i = 0; i < STRESS_READER_THREADS; i++) {
+        readers[i].hashTable = &hashTable;
+        readers[i].phase = &phase;
+        readers[i].random = RandomGenerator(12345 + i);
+        workers.push_back(thread(stressReader, ref(readers[i])));
+    }
+    this_thread::sleep_for(chrono::milliseconds(STRESS_IDLE_MILLISECONDS));
+
+    // Insert into the existing countries in turn, adding a new country every so often, and
+    // remove or move one of the writer's own earlier parcels at regular intervals
+    long long parcelsBefore = hashTable.parcelCount();
+    phase = 1;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    RandomGenerator random(54321);
+    struct WrittenParcel {
+        int countryId;      // Dictionary ID of the parcel's country
+        int weight;         // Weight the parcel was last given
+        int64_t valuation;  // Valuation the parcel was last given, in cents
+    };
+    vector<WrittenParcel> inserted;     // The writer's parcels that are still in the index
+    int newCountries = 0, lostParcels = 0;
+    long long removals = 0, updates = 0;
+    int countryId = 0;
+    for (int i = 0; i < STRESS_INSERTS; i++) {
+        if (i % STRESS_NEW_COUNTRY_INTERVAL == STRESS_NEW_COUNTRY_INTERVAL - 1) {
+            char name[32];
+            snprintf(name, sizeof(name), "Stress-%d", ++newCountries);
+            countryId = countryDictionary.intern(name, strlen(name));
+        }
+        else {
+            countryId = i % existingCountries;
+        }
+        WrittenParcel parcel = { countryId, 1 + random.below(50000), 1000 + (int64_t)random.below(200000) };
+        hashTable.insert(parcel.countryId, parcel.weight, parcel.valuation);
+        inserted.push_back(parcel);
+
+        if (i % STRESS_REMOVE_INTERVAL == STRESS_REMOVE_INTERVAL - 1) {
+            size_t victim = random.below((int)inserted.size());
+            lostParcels += !hashTable.remove(inserted[victim].countryId, inserted[victim].weight, inserted[victim].valuation);
+            inserted[victim] = inserted.back();
+            inserted.pop_back();
+            removals++;
+        }
+        if (i % STRESS_UPDATE_INTERVAL == STRESS_UPDATE_INTERVAL - 1) {
+            WrittenParcel& moved = inserted[random.below((int)inserted.size())];
+            int newWeight = 1 + random.below(50000);
+            int64_t newValuation = 1000 + (int64_t)random.below(200000);
+            lostParcels += !hashTable.update(moved.countryId, moved.weight, moved.valuation, newWeight, newValuation);
+            moved.weight = newWeight;
+            moved.valuation = newValuation;
+            updates++;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    phase = 2;
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    printf("Inserted %d parcels, removed %lld and updated %lld (%d new countries) in %.3f s while reading\n",
+        STRESS_INSERTS, removals, updates, newCountries, seconds);
+
+    // Report the totals query latency of both phases across all readers
+    const char* phaseNames[2] = { "Readers alone", "During inserts" };
+    long long checks = 0, failures = 0;
+    for (int p = 0; p < 2; p++) {
+        vector<float> latencies;
+        for (int i = 0; i < STRESS_READER_THREADS; i++) {
+            latencies.insert(latencies.end(), readers[i].latencies[p].begin(), readers[i].latencies[p].end());
+        }
+        if (latencies.empty()) {
+            printf("%-15s no queries\n", phaseNames[p]);
+            continue;
+        }
+        sort(latencies.begin(), latencies.end());
+        printf("%-15s %9zu queries, totals latency p50 %.2f us, p99 %.2f us, max %.2f us\n", phaseNames[p], latencies.size(),
+            latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0, latencies.back() / 1000.0);
+    }
+    for (int i = 0; i < STRESS_READER_THREADS; i++) {
+        checks += readers[i].checks;
+        failures += readers[i].failures;
+    }
+    printf("Consistency checks: %lld passed, %lld failed\n", checks - failures, failures);
+
+    // Every removal and update must have found its parcel, and nothing else may have gone missing
+    long long parcelsAfter = hashTable.parcelCount();
+    bool complete = lostParcels == 0 && parcelsAfter == parcelsBefore + STRESS_INSERTS - removals;
+    printf("Writer: %d parcel(s) not found for removal or update, %lld parcels left (expected %lld)\n",
+        lostParcels, parcelsAfter, parcelsBefore + STRESS_INSERTS - removals);
+    return failures == 0 && complete;
+}
+
+/*
+ * FUNCTION    : stressReader
+ * DESCRIPTION : Body of a stress test reader thread. Until told to stop it
+ *               times totals queries on random countries, and every
+ *               STRESS_CHECK_INTERVAL queries it walks a country's leaves
+ *               under one read lock to check that the weights are in order,
+ *               the leaf links agree, the root summary matches the leaves
+ *               and the country still has the parcels it had before the
+ *               writer started, which the writer never removes.
+ * PARAMETERS  : StressReader& reader - The thread's state and results.
+ */
+void stressReader(StressReader& reader) {
+    long long queries = 0;
+    int currentPhase;
+    while ((currentPhase = reader.phase->load()) < 2) {
+        int countryId = reader.random.below(countryDictionary.count());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        {
+            TreeReader tree = reader.hashTable->getTree(countryId);
+            if (tree && tree->root && tree->root->summary.totalWeight < 0) {
+                reader.failures++;  // Never true; keeps the query from being optimized away
+            }
+        }
+        reader.latencies[currentPhase].push_back((float)chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+
+        if (++queries % STRESS_CHECK_INTERVAL != 0) {
+            continue;
+        }
+        TreeReader tree = reader.hashTable->getTree(countryId);
+        if (!tree || !tree->root) {
+            continue;
+        }
+        int count = 0;
+        long long totalWeight = 0;
+        bool ordered = true;
+        BSTDataNode* previous = nullptr;
+        for (BSTDataNode* leaf = tree->head; leaf; previous = leaf, leaf = leaf->next) {
+            ordered = ordered && leaf->prev == previous && (!previous || previous->weights[previous->count - 1] <= leaf->weights[0]);
+            for (int i = 0; i < leaf->count; i++) {
+                ordered = ordered && (i == 0 || leaf->weights[i - 1] <= leaf->weights[i]) && leaf->parcels[i]->weight == leaf->weights[i];
+                totalWeight += leaf->weights[i];
+            }
+            count += leaf->count;
+        }
+        if ((int)reader.loadedCounts.size() <= countryId) {
+            reader.loadedCounts.resize(countryId + 1, 0);
+        }
+        reader.checks++;
+        if (!ordered || previous != tree->tail || count != tree->root->summary.count ||
+            totalWeight != tree->root->summary.totalWeight || count < reader.loadedCounts[countryId]) {
+            reader.failures++;
+        }
+        if (currentPhase == 0) {
+            reader.loadedCounts[countryId] = count;
+        }
+    }
+}
+
+/*
+ * FUNCTION    : readFile
+ * DESCRIPTION : Reads parcel data from a file and adds every parcel to the
+ *               hash table. The file should contain country, weight, and
+ *               valuation data for each parcel, one parcel per line. The file
+ *               is mapped into memory and split into line-aligned slices that
+ *               are parsed on all cores. The parcels are then grouped into a
+ *               run per country, and the runs are sorted and built straight
+ *               into packed trees on all cores, one country per thread at a
+ *               time. Malformed lines are skipped and reported, and the load
+ *               throughput is printed at the end. A last line with no
+ *               newline is not read, since a writer may still be adding it.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* filename - The name of the file to read from.
+ *               int64_t& loadedSize  - Receives the number of bytes read, up to
+ *                                      and including the last newline.
+ * RETURNS     : bool - Returns false if the file could not be opened.
+ */
+bool readFile(HashTable& hashTable, const char* filename, int64_t& loadedSize) {
+    OperationTimer timer(OP_LOAD);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(filename)) {
+        fprintf(statusOutput, "Failed to open file %s\n", filename);
+        return false;
+    }
+
+    // Only read up to the last newline; a last line without one may still be being written,
+    // and is left for --follow to pick up once it is complete
+    size_t size = file.size;
+    while (size > 0 && file.data[size - 1] != '\n') {
+        size--;
+    }
+    if (size < file.size) {
+        fprintf(statusOutput, "Left out the last line of %s, which does not end in a newline yet\n", filename);
+    }
+
+    // Use one slice per core, but never make slices so small that thread startup dominates
+    size_t threadCount = thread::hardware_concurrency();
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    size_t chunkCount = size / MIN_LOAD_CHUNK_SIZE + 1;
+    if (chunkCount > threadCount) {
+        chunkCount = threadCount;
+    }
+
+    // Cut the file at the first newline after each even split point
+    vector<LoadChunk> chunks(chunkCount);
+    const char* fileEnd = file.data + size;
+    const char* begin = file.data;
+    for (size_t i = 0; i < chunkCount; i++) {
+        const char* end = fileEnd;
+        if (i + 1 < chunkCount) {
+            end = file.data + size / chunkCount * (i + 1);
+            if (end < begin) {
+                end = begin;
+            }
+            const char* newline = (const char*)memchr(end, '\n', fileEnd - end);
+            end = newline ? newline + 1 : fileEnd;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    // Parse the slices in parallel, with the first one handled on this thread
+    vector<thread> workers;
+    for (size_t i = 1; i < chunkCount; i++) {
+        workers.push_back(thread(prepareChunk, ref(chunks[i])));
+    }
+    prepareChunk(chunks[0]);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    chrono::steady_clock::time_point parsed = chrono::steady_clock::now();
+
+    // Size each country's run, then copy the parcels into the runs in file order
+    BulkLoad load(&hashTable);
+    vector<size_t> runSizes(countryDictionary.count(), 0);
+    for (size_t i = 0; i < chunkCount; i++) {
+        for (size_t j = 0; j < chunks[i].countryIds.size(); j++) {
+            runSizes[chunks[i].countryIds[j]]++;
+        }
+    }
+    load.runs.resize(runSizes.size());
+    for (size_t id = 0; id < runSizes.size(); id++) {
+        load.runs[id].reserve(runSizes[id]);
+        if (runSizes[id] > 0) {
+            load.order.push_back((int)id);
+        }
+    }
+    long long loaded = 0, malformed = 0, lineOffset = 0;
+    long long reported[MAX_REPORTED_MALFORMED_LINES];
+    int reportedCount = 0;
+    for (size_t i = 0; i < chunkCount; i++) {
+        LoadChunk& chunk = chunks[i];
+        for (size_t j = 0; j < chunk.records.size(); j++) {
+            BulkParcel parcel = { chunk.records[j].weight, chunk.records[j].valuation };
+            load.runs[chunk.countryIds[j]].push_back(parcel);
+        }
+        for (long long j = 0; j < chunk.malformed && j < MAX_REPORTED_MALFORMED_LINES && reportedCount < MAX_REPORTED_MALFORMED_LINES; j++) {
+            reported[reportedCount++] = lineOffset + chunk.malformedLines[j] + 1;
+        }
+        loaded += (long long)chunk.records.size();
+        malformed += chunk.malformed;
+        lineOffset += chunk.lines;
+        vector<ParcelRecord>().swap(chunk.records);  // Release each slice's records as soon as they are grouped
+        vector<int>().swap(chunk.countryIds);
+    }
+
+    // Build the biggest countries first so one large run is not left for the end
+    sort(load.order.begin(), load.order.end(), [&runSizes](int a, int b) {
+        return runSizes[a] > runSizes[b];
+    });
+    size_t buildThreads = threadCount < load.order.size() ? threadCount : load.order.size();
+    for (size_t i = 1; i < buildThreads; i++) {
+        workers.push_back(thread(buildCountryTrees, ref(load)));
+    }
+    buildCountryTrees(load);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    double parseSeconds = chrono::duration<double>(parsed - start).count();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    loadedSize = (int64_t)size;
+    double megabytes = size / (1024.0 * 1024.0);
+    fprintf(statusOutput, "Loaded %lld parcels from %s (%.1f MB) in %.3f s using %d thread(s): %.1f MB/s, %.0f records/s\n",
+        loaded, filename, megabytes, seconds, (int)chunkCount, megabytes / seconds, loaded / seconds);
+    fprintf(statusOutput, "Parsed in %.3f s, grouped, sorted and built %d countries in %.3f s using %d thread(s)\n",
+        parseSeconds, (int)load.order.size(), seconds - parseSeconds, (int)(buildThreads > 0 ? buildThreads : 1));
+    if (malformed > 0) {
+        fprintf(statusOutput, "Skipped %lld malformed line(s), starting with line", malformed);
+        for (int i = 0; i < reportedCount; i++) {
+            fprintf(statusOutput, "%s %lld", i == 0 ? "" : ",", reported[i]);
+        }
+        fprintf(statusOutput, "\n");
+    }
+    reportMemoryUsage(hashTable);
+    return true;
+}
+
+/*
+ * FUNCTION    : saveSnapshot
+ * DESCRIPTION : Writes the whole index to a binary snapshot file so the next
+ *               start can skip parsing the manifest. The file is written
+ *               under a temporary name and renamed into place once complete,
+ *               so a crash never leaves a half-written snapshot behind.
+ * PARAMETERS  : HashTable& hashTable       - Reference to the loaded hash table.
+ *               const char* snapshotPath   - The snapshot file to write.
+ *               int64_t sourceSize         - Size of the manifest, taken before it was read.
+ *               int64_t sourceModified     - Its modification time, taken at the same moment.
+ * RETURNS     : bool - Returns true if the snapshot was written; false otherwise.
+ */
+bool saveSnapshot(HashTable& hashTable, const char* snapshotPath, int64_t sourceSize, int64_t sourceModified) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceModified = sourceModified;
+
+    // Lay out the country records and name section before anything is written
+    vector<CountryIndex*> entries;
+    vector<SnapshotCountry> countries;
+    for (size_t i = 0; i < hashTable.entries.size(); i++) {
+        CountryIndex* entry = hashTable.entries[i];
+        if (!entry->tree.root) {
+            continue;
+        }
+        SnapshotCountry country;
+        memset(&country, 0, sizeof(country));
+        country.nameOffset = header.namesSize;
+        country.nameLength = (uint32_t)strlen(countryDictionary.name(entry->countryId));
+        country.firstParcel = header.parcelCount;
+        country.parcelCount = (uint64_t)entry->tree.root->summary.count;
+        header.namesSize += country.nameLength;
+        header.parcelCount += country.parcelCount;
+        entries.push_back(entry);
+        countries.push_back(country);
+    }
+    header.namesSize = (header.namesSize + 7) / 8 * 8;
+    header.countryCount = (uint32_t)countries.size();
+
+    char temporaryPath[FILENAME_MAX];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", snapshotPath);
+    FILE* file = fopen(temporaryPath, "wb");
+    if (!file) {
+        fprintf(statusOutput, "Failed to create snapshot %s\n", temporaryPath);
+        return false;
+    }
+
+    // Leave room for the header, which is only complete once the checksum is known
+    fwrite(&header, sizeof(header), 1, file);
+    SnapshotWriter writer(file);
+    if (!countries.empty()) {
+        writer.write(countries.data(), countries.size() * sizeof(SnapshotCountry));
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        writer.write(countryDictionary.name(entries[i]->countryId), countries[i].nameLength);
+    }
+    writer.align();
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (BSTDataNode* leaf = entries[i]->tree.head; leaf; leaf = leaf->next) {
+            writer.write(leaf->weights, leaf->count * sizeof(int));
+        }
+    }
+    writer.align();
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (BSTDataNode* leaf = entries[i]->tree.head; leaf; leaf = leaf->next) {
+            for (int j = 0; j < leaf->count; j++) {
+                writer.write(&leaf->parcels[j]->valuation, sizeof(int64_t));
+            }
+        }
+    }
+    writer.align();
+    writer.flush();
+
+    header.payloadSize = writer.written;
+    header.checksum = writer.checksum;
+    bool written = !writer.failed && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    written = (fclose(file) == 0) && written;
+    if (written) {
+#ifdef _WIN32
+        written = MoveFileExA(temporaryPath, snapshotPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        written = rename(temporaryPath, snapshotPath) == 0;
+#endif
+    }
+    if (!written) {
+        remove(temporaryPath);
+        fprintf(statusOutput, "Failed to write snapshot %s\n", snapshotPath);
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOutput, "Saved snapshot %s (%.1f MB) in %.3f s\n", snapshotPath, (sizeof(header) + header.payloadSize) / (1024.0 * 1024.0), seconds);
+    return true;
+}
+
+/*
+ * FUNCTION    : loadSnapshot
+ * DESCRIPTION : Maps a snapshot file and, if it is intact and was built from
+ *               the current manifest, builds every country's tree straight
+ *               from its sorted weight and valuation columns.
+ * PARAMETERS  : HashTable& hashTable       - Reference to an empty hash table.
+ *               const char* snapshotPath   - The snapshot file to read.
+ *               const char* sourcePath     - The manifest the snapshot must match.
+ *               int64_t& loadedSize        - Receives the size of the manifest the
+ *                                            snapshot was built from.
+ * RETURNS     : bool - Returns true if the index was loaded from the snapshot;
+ *               false if the caller should load the manifest instead.
+ */
+bool loadSnapshot(HashTable& hashTable, const char* snapshotPath, const char* sourcePath, int64_t& loadedSize) {
+    OperationTimer timer(OP_SNAPSHOT_LOAD);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(snapshotPath)) {
+        return false;  // No snapshot yet, which is not worth reporting
+    }
+
+    // Check the header, the section sizes and the checksum before trusting anything in the file
+    SnapshotHeader header;
+    if (file.size < sizeof(header)) {
+        fprintf(statusOutput, "Ignoring snapshot %s: file is truncated\n", snapshotPath);
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        fprintf(statusOutput, "Ignoring snapshot %s: not a version %d snapshot\n", snapshotPath, SNAPSHOT_VERSION);
+        return false;
+    }
+    uint64_t countriesSize = (uint64_t)header.countryCount * sizeof(SnapshotCountry);
+    uint64_t columnSize = (header.parcelCount * sizeof(int) + 7) / 8 * 8;
+    if (header.payloadSize != file.size - sizeof(header) || header.parcelCount > header.payloadSize ||
+        countriesSize + header.namesSize + columnSize + header.parcelCount * sizeof(int64_t) != header.payloadSize) {
+        fprintf(statusOutput, "Ignoring snapshot %s: file is truncated\n", snapshotPath);
+        return false;
+    }
+    const unsigned char* payload = (const unsigned char*)file.data + sizeof(header);
+    if (checksumBlock(SNAPSHOT_CHECKSUM_SEED, payload, header.payloadSize) != header.checksum) {
+        fprintf(statusOutput, "Ignoring snapshot %s: checksum mismatch\n", snapshotPath);
+        return false;
+    }
+
+    // A manifest that has changed since the snapshot was written takes priority
+    int64_t sourceSize, sourceModified;
+    if (getFileInfo(sourcePath, sourceSize, sourceModified) &&
+        (sourceSize != header.sourceSize || sourceModified != header.sourceModified)) {
+        fprintf(statusOutput, "Ignoring snapshot %s: %s has changed since it was written\n", snapshotPath, sourcePath);
+        return false;
+    }
+
+    loadedSize = header.sourceSize;
+    const SnapshotCountry* countries = (const SnapshotCountry*)payload;
+    const char* names = (const char*)(payload + countriesSize);
+    const int* weights = (const int*)(payload + countriesSize + header.namesSize);
+    const int64_t* valuations = (const int64_t*)(payload + countriesSize + header.namesSize + columnSize);
+    for (uint32_t i = 0; i < header.countryCount; i++) {
+        const SnapshotCountry& country = countries[i];
+        if (country.nameOffset + country.nameLength > header.namesSize ||
+            country.firstParcel > header.parcelCount || country.parcelCount > header.parcelCount - country.firstParcel) {
+            fprintf(statusOutput, "Ignoring snapshot %s: country record %u is out of range\n", snapshotPath, i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.countryCount; i++) {
+        const SnapshotCountry& country = countries[i];
+        int countryId = countryDictionary.intern(names + country.nameOffset, country.nameLength);
+        hashTable.findOrCreateEntry(countryId)->tree.buildFromSorted(countryId,
+            weights + country.firstParcel, valuations + country.firstParcel, (size_t)country.parcelCount);
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOutput, "Loaded %llu parcels for %u countries from snapshot %s in %.3f s\n",
+        (unsigned long long)header.parcelCount, header.countryCount, snapshotPath, seconds);
+    reportMemoryUsage(hashTable);
+    return true;
+}
+
+/*
+ * FUNCTION    : getFileInfo
+ * DESCRIPTION : Looks up the size and last modification time of a file. The
+ *               time is kept to the nanosecond where the platform records it,
+ *               so two writes within the same second still tell apart.
+ * PARAMETERS  : const char* path   - The file to look up.
+ *               int64_t& size      - Receives the size in bytes.
+ *               int64_t& modified  - Receives the modification time in nanoseconds.
+ * RETURNS     : bool - Returns false if the file does not exist.
+ */
+bool getFileInfo(const char* path, int64_t& size, int64_t& modified) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(path, &info) != 0) {
+        return false;
+    }
+#else
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return false;
+    }
+#endif
+    size = (int64_t)info.st_size;
+#if defined(_WIN32)
+    modified = (int64_t)info.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+    modified = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    modified = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+/*
+ * FUNCTION    : partitionManifest
+ * DESCRIPTION : Splits the loaded index into shard files for lazy mode. With
+ *               no shard count every country gets a file of its own;
+ *               otherwise the countries are spread over that many files by a
+ *               hash of their names, so a country always lands in the same
+ *               file. In a file, each country's parcels are stored as a
+ *               column of weights and then a column of valuations in cents,
+ *               lightest first, as the snapshot stores them. SHARD_INDEX_NAME
+ *               lists the file, offset, parcel count and checksum of every
+ *               country. The shard files are named after a new generation,
+ *               one past that of the index already in the directory, and the
+ *               index is written last, under a temporary name that is renamed
+ *               into place. Until then the old index keeps pointing at its
+ *               own complete files, so a partitioning that failed part way is
+ *               never used; the new files are removed on failure, and the old
+ *               generation's files once the new index is in place.
+ * PARAMETERS  : HashTable& hashTable  - Reference to the loaded hash table.
+ *               const char* directory - The directory to write, created if needed.
+ *               int shardCount        - Number of shard files, or 0 for one per country.
+ * RETURNS     : bool - Returns false if anything could not be written.
+ */
+bool partitionManifest(HashTable& hashTable, const char* directory, int shardCount) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!makeDirectory(directory)) {
+        fprintf(statusOutput, "Failed to create directory %s\n", directory);
+        return false;
+    }
+
+    // Assign every country with parcels to a shard
+    vector<CountryIndex*> countries;
+    long long parcelCount = 0;
+    for (size_t i = 0; i < hashTable.entries.size(); i++) {
+        CountryIndex* entry = hashTable.entries[i];
+        if (entry->tree.root) {
+            countries.push_back(entry);
+            parcelCount += entry->tree.root->summary.count;
+        }
+    }
+    int fileCount = shardCount > 0 ? shardCount : (int)countries.size();
+    vector<vector<CountryIndex*>> members(fileCount);
+    for (size_t i = 0; i < countries.size(); i++) {
+        const char* name = countryDictionary.name(countries[i]->countryId);
+        size_t shard = shardCount > 0 ? (size_t)(CountryDictionary::hashFunction(name, strlen(name)) % shardCount) : i;
+        members[shard].push_back(countries[i]);
+    }
+
+    char indexPath[FILENAME_MAX];
+    char temporaryPath[FILENAME_MAX];
+    snprintf(indexPath, sizeof(indexPath), "%s/" SHARD_INDEX_NAME, directory);
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s/" SHARD_INDEX_NAME ".tmp", directory);
+    ShardIndexHeader previous;
+    FILE* index = fopen(indexPath, "r");
+    if (index) {
+        if (!readShardIndexHeader(index, previous)) {
+            previous = ShardIndexHeader();
+        }
+        fclose(index);
+    }
+    long long generation = previous.generation + 1;
+    index = fopen(temporaryPath, "w");
+    if (!index) {
+        fprintf(statusOutput, "Failed to create shard index %s\n", temporaryPath);
+        return false;
+    }
+    fprintf(index, "%s %d %lld %d %d %lld\n", SHARD_INDEX_MAGIC, SHARD_INDEX_VERSION, generation, fileCount, (int)countries.size(), parcelCount);
+
+    bool written = true;
+    int filesWritten = 0;
+    for (int shard = 0; shard < fileCount && written; shard++) {
+        if (members[shard].empty()) {
+            continue;
+        }
+        char path[FILENAME_MAX];
+        snprintf(path, sizeof(path), "%s/" SHARD_FILE_FORMAT, directory, generation, shard);
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            fprintf(statusOutput, "Failed to create shard %s\n", path);
+            written = false;
+            break;
+        }
+        int64_t offset = 0;
+        vector<int> weights;
+        vector<int64_t> valuations;
+        for (size_t i = 0; i < members[shard].size(); i++) {
+            BST& tree = members[shard][i]->tree;
+            int count = tree.root->summary.count;
+            weights.clear();
+            valuations.clear();
+            for (BSTDataNode* leaf = tree.head; leaf; leaf = leaf->next) {
+                weights.insert(weights.end(), leaf->weights, leaf->weights + leaf->count);
+                for (int j = 0; j < leaf->count; j++) {
+                    valuations.push_back(leaf->parcels[j]->valuation);
+                }
+            }
+            fwrite(weights.data(), sizeof(int), weights.size(), file);
+            fwrite(valuations.data(), sizeof(int64_t), valuations.size(), file);
+            fprintf(index, "%d %lld %d %016llx %s\n", shard, (long long)offset, count,
+                (unsigned long long)checksumColumns(weights, valuations), countryDictionary.name(members[shard][i]->countryId));
+            offset += (int64_t)count * (sizeof(int) + sizeof(int64_t));
+        }
+        bool failed = ferror(file) != 0;
+        if (fclose(file) != 0 || failed) {
+            fprintf(statusOutput, "Failed to write shard %s\n", path);
+            written = false;
+        }
+        filesWritten++;
+    }
+    written = !ferror(index) && written;
+    written = fclose(index) == 0 && written;
+    if (written) {
+#ifdef _WIN32
+        written = MoveFileExA(temporaryPath, indexPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        written = rename(temporaryPath, indexPath) == 0;
+#endif
+    }
+    if (!written) {
+        remove(temporaryPath);
+        removeShardFiles(directory, generation, fileCount);
+        fprintf(statusOutput, "Failed to write shard index %s\n", indexPath);
+        return false;
+    }
+    if (previous.generation > 0) {
+        removeShardFiles(directory, previous.generation, previous.fileCount);
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOutput, "Partitioned %lld parcels of %d countries into %d shard file(s) in %s in %.3f s\n",
+        parcelCount, (int)countries.size(), filesWritten, directory, seconds);
+    return true;
+}
+
+/*
+ * FUNCTION    : openShards
+ * DESCRIPTION : Starts lazy mode from a directory written by
+ *               partitionManifest. Only the index is read: every country in
+ *               it gets a hash table entry that remembers where its parcels
+ *               are but holds none of them. The hash table loads a country
+ *               from its shard the first time it is used, and evicts the
+ *               least recently used countries once the loaded trees take
+ *               more than the memory budget.
+ * PARAMETERS  : HashTable& hashTable     - Reference to an empty hash table.
+ *               const char* directory    - The partitioned manifest.
+ *               double budgetMegabytes   - Megabytes of trees to keep loaded.
+ * RETURNS     : bool - Returns false if the index is missing or malformed.
+ */
+bool openShards(HashTable& hashTable, const char* directory, double budgetMegabytes) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "%s/" SHARD_INDEX_NAME, directory);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(statusOutput, "Failed to open shard index %s\n", path);
+        return false;
+    }
+
+    ShardIndexHeader header;
+    if (!readShardIndexHeader(file, header)) {
+        fprintf(statusOutput, "%s is not a version %d shard index\n", path, SHARD_INDEX_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    hashTable.shards = new LazyShards(directory, header.generation, (size_t)(budgetMegabytes * 1024 * 1024));
+    char line[MAX_COUNTRY_NAME_LENGTH + 100];
+    int countries = 0;
+    long long parcels = 0;
+    bool intact = true;
+    while (intact && fgets(line, sizeof(line), file)) {
+        int shard = -1;
+        long long offset = -1;
+        int count = 0;
+        unsigned long long checksum = 0;
+        int nameStart = 0;
+        sscanf_s(line, "%d %lld %d %llx %n", &shard, &offset, &count, &checksum, &nameStart);
+        size_t nameLength = nameStart > 0 ? strcspn(line + nameStart, "\r\n") : 0;
+        intact = shard >= 0 && shard < header.fileCount && offset >= 0 && count > 0 && nameLength > 0;
+        if (!intact) {
+            break;
+        }
+        CountryIndex* entry = hashTable.findOrCreateEntry(countryDictionary.intern(line + nameStart, nameLength));
+        entry->resident = false;
+        entry->shard = shard;
+        entry->shardOffset = offset;
+        entry->shardParcels = count;
+        entry->shardChecksum = checksum;
+        countries++;
+        parcels += count;
+    }
+    fclose(file);
+    if (!intact || countries != header.countryCount || parcels != header.parcelCount) {
+        fprintf(statusOutput, "Shard index %s is damaged\n", path);
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOutput, "Indexed %lld parcels of %d countries in %s in %.3f s; countries load on first use, keeping up to %.0f MB\n",
+        parcels, countries, directory, seconds, budgetMegabytes);
+    return true;
+}
+
+/*
+ * FUNCTION    : readShardIndexHeader
+ * DESCRIPTION : Reads the first line of a shard index written by
+ *               partitionManifest: the magic word, the version, the
+ *               generation of its shard files, the number of shards, and the
+ *               country and parcel counts.
+ * PARAMETERS  : FILE* file                - The index, positioned at its start.
+ *               ShardIndexHeader& header  - Receives the fields read.
+ * RETURNS     : bool - Returns false if the line is missing, malformed or of another version.
+ */
+bool readShardIndexHeader(FILE* file, ShardIndexHeader& header) {
+    char line[200];
+    size_t magicLength = strlen(SHARD_INDEX_MAGIC);
+    int version = 0;
+    return fgets(line, sizeof(line), file) && strncmp(line, SHARD_INDEX_MAGIC, magicLength) == 0 &&
+        sscanf_s(line + magicLength, "%d %lld %d %d %lld", &version, &header.generation, &header.fileCount,
+            &header.countryCount, &header.parcelCount) == 5 &&
+        version == SHARD_INDEX_VERSION && header.generation > 0 && header.fileCount >= 0;
+}
+
+/*
+ * FUNCTION    : removeShardFiles
+ * DESCRIPTION : Removes the shard files of one generation, for a partitioning
+ *               that failed or one that a newer index has replaced. Shard
+ *               numbers without a file are skipped.
+ * PARAMETERS  : const char* directory - The partitioned manifest.
+ *               long long generation  - Generation of the files to remove.
+ *               int fileCount         - Number of shards the partitioning used.
+ * RETURNS     : void
+ */
+void removeShardFiles(const char* directory, long long generation, int fileCount) {
+    char path[FILENAME_MAX];
+    for (int shard = 0; shard < fileCount; shard++) {
+        snprintf(path, sizeof(path), "%s/" SHARD_FILE_FORMAT, directory, generation, shard);
+        remove(path);
+    }
+}
+
+/*
+ * FUNCTION    : makeDirectory
+ * DESCRIPTION : Creates a directory, treating one that already exists as
+ *               success.
+ * PARAMETERS  : const char* path - The directory to create.
+ * RETURNS     : bool - Returns false if the directory could not be created.
+ */
+bool makeDirectory(const char* path) {
+#ifdef _WIN32
+    return CreateDirectoryA(path, nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+/*
+ * FUNCTION    : followManifest
+ * DESCRIPTION : Body of the thread started by --follow. It waits for the
+ *               manifest to change and inserts the parcels in any lines
+ *               appended since it last looked. On Linux it sleeps on inotify
+ *               until the file is written; elsewhere, or if inotify cannot
+ *               watch the file, it checks the file's size every
+ *               FOLLOW_POLL_MILLISECONDS instead.
+ * PARAMETERS  : ManifestFollower& follower - The thread's state and results.
+ */
+void followManifest(ManifestFollower& follower) {
+#ifdef __linux__
+    const uint32_t watchedEvents = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    int notifier = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int watch = notifier >= 0 ? inotify_add_watch(notifier, follower.path, watchedEvents) : -1;
+    follower.notified = watch >= 0;
+#endif
+    while (!follower.stopping) {
+        readAppendedParcels(follower);
+#ifdef __linux__
+        if (watch >= 0) {
+            // Sleep until the file changes; the timeout only bounds how long a stop request waits
+            pollfd descriptor = { notifier, POLLIN, 0 };
+            if (poll(&descriptor, 1, FOLLOW_POLL_MILLISECONDS) <= 0) {
+                continue;
+            }
+            alignas(inotify_event) char events[4096];
+            bool replaced = false;
+            ssize_t length;
+            while ((length = read(notifier, events, sizeof(events))) > 0) {
+                for (char* event = events; event < events + length; event += sizeof(inotify_event) + ((inotify_event*)event)->len) {
+                    replaced = replaced || (((inotify_event*)event)->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) != 0;
+                }
+            }
+            if (replaced) {
+                // The watch follows the old file, so move it to whatever now has the manifest's name
+                inotify_rm_watch(notifier, watch);
+                watch = inotify_add_watch(notifier, follower.path, watchedEvents);
+            }
+            continue;
+        }
+#endif
+        this_thread::sleep_for(chrono::milliseconds(FOLLOW_POLL_MILLISECONDS));
+    }
+#ifdef __linux__
+    if (notifier >= 0) {
+        close(notifier);
+    }
+#endif
+}
+
+/*
+ * FUNCTION    : readAppendedParcels
+ * DESCRIPTION : Reads whatever has been added to the manifest past the
+ *               follower's offset and inserts the parcels on every complete
+ *               line. The offset only moves past complete lines, so a last
+ *               line without its newline yet is read again, whole, once the
+ *               rest of it arrives. If the file has shrunk it is taken to
+ *               have been rewritten, and following resumes at its end.
+ * PARAMETERS  : ManifestFollower& follower - The follower's state.
+ */
+void readAppendedParcels(ManifestFollower& follower) {
+    int64_t size, modified;
+    if (!getFileInfo(follower.path, size, modified) || size == follower.offset) {
+        return;
+    }
+    if (size < follower.offset) {
+        printf("\n%s shrank from %lld to %lld bytes; following new lines from its end\n", follower.path, (long long)follower.offset, (long long)size);
+        follower.offset = size;
+        return;
+    }
+
+    FILE* file = fopen(follower.path, "rb");
+    if (!file) {
+        return;
+    }
+    bool positioned = seekFile(file, follower.offset);
+    int64_t position = follower.offset;
+    follower.pending.clear();
+    while (positioned && position < size) {
+        // Add the next block to the unfinished line and parse every complete line in front of it
+        size_t kept = follower.pending.size();
+        size_t wanted = (size_t)(size - position) < FOLLOW_READ_SIZE ? (size_t)(size - position) : FOLLOW_READ_SIZE;
+        follower.pending.resize(kept + wanted);
+        size_t got = fread(follower.pending.data() + kept, 1, wanted, file);
+        follower.pending.resize(kept + got);
+        position += (int64_t)got;
+        if (got == 0) {
+            break;
+        }
+        const char* begin = follower.pending.data();
+        const char* lastNewline = nullptr;
+        for (const char* c = begin + follower.pending.size(); c > begin; c--) {
+            if (c[-1] == '\n') {
+                lastNewline = c - 1;
+                break;
+            }
+        }
+        if (!lastNewline) {
+            continue;
+        }
+        LoadChunk chunk;
+        chunk.begin = begin;
+        chunk.end = lastNewline + 1;
+        parseChunk(chunk);
+        for (size_t i = 0; i < chunk.records.size(); i++) {
+            ParcelRecord& record = chunk.records[i];
+            follower.hashTable->insert(countryDictionary.intern(record.country, record.countryLength), record.weight, record.valuation);
+        }
+        follower.followed += (long long)chunk.records.size();
+        follower.malformed += chunk.malformed;
+        follower.offset += (int64_t)(chunk.end - begin);
+        follower.pending.erase(follower.pending.begin(), follower.pending.begin() + (chunk.end - begin));
+    }
+    fclose(file);
+}
+
+/*
+ * FUNCTION    : stopFollowing
+ * DESCRIPTION : Asks the --follow thread to finish, waits for it and prints
+ *               how many appended parcels it inserted.
+ * PARAMETERS  : ManifestFollower& follower - The follower's state.
+ *               thread& followerThread     - The thread running followManifest.
+ */
+void stopFollowing(ManifestFollower& follower, thread& followerThread) {
+    follower.stopping = true;
+    followerThread.join();
+    printf("Followed %lld parcels appended to %s using %s (%lld malformed lines skipped)\n",
+        follower.followed, follower.path, follower.notified ? "inotify" : "polling", follower.malformed);
+}
+
+/*
+ * FUNCTION    : openServer
+ * DESCRIPTION : Binds the query server's listening socket and creates the
+ *               eventfd its workers wake the event loop with, the signalfd
+ *               that reports Ctrl+C and termination, and the epoll instance
+ *               watching all three. SIGINT and SIGTERM are blocked here so
+ *               that every thread started afterwards inherits the mask and
+ *               the signals reach only the signalfd; main calls this before
+ *               loading the index, so a signal during the load stops the
+ *               server as soon as it starts.
+ * PARAMETERS  : QueryServer& server - The server to set up.
+ *               const char* address - A Unix socket path (anything with a
+ *                                     '/') or a TCP [host:]port, the host
+ *                                     defaulting to 127.0.0.1.
+ * RETURNS     : bool - Returns false if the server could not be set up.
+ */
+bool openServer(QueryServer& server, const char* address) {
+#ifdef __linux__
+    server.address = address;
+    server.listener = openSocket(address, true, !server.allowRemote);
+    if (server.listener < 0) {
+        return false;
+    }
+    fcntl(server.listener, F_SETFL, fcntl(server.listener, F_GETFL) | O_NONBLOCK);
+
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    server.signals = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.poller = epoll_create1(EPOLL_CLOEXEC);
+    if (server.signals < 0 || server.wakeup < 0 || server.poller < 0) {
+        fprintf(stderr, "Failed to set up the event loop: %s\n", strerror(errno));
+        closeServer(server);
+        return false;
+    }
+
+    // The fixed descriptors are told apart from connections by the address of their field
+    int* fixed[] = { &server.listener, &server.wakeup, &server.signals };
+    for (int* descriptor : fixed) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = descriptor;
+        epoll_ctl(server.poller, EPOLL_CTL_ADD, *descriptor, &event);
+    }
+    return true;
+#else
+    (void)server;
+    fprintf(stderr, "Cannot serve %s: --serve needs epoll, which only Linux has\n", address);
+    return false;
+#endif
+}
+
+/*
+ * FUNCTION    : runServer
+ * DESCRIPTION : Runs the query server's event loop. Each client sends batch
+ *               commands, one per line, and may send many before reading
+ *               any answers. The event loop reads the lines off non-blocking
+ *               sockets and queues them for a pool of worker threads, one
+ *               per core; responses are sent back in the order the lines
+ *               came in. A response is the rows --batch would write for
+ *               the line, without the CSV header, followed by an empty line,
+ *               so a blank line or comment gets just the empty line.
+ *               A response has at most SERVER_MAX_ROWS parcel rows. Each
+ *               line's job holds the most bytes its response could take
+ *               against its connection, and a connection's lines are only
+ *               run while those and its unsent responses fit in
+ *               SERVER_MAX_OUTPUT, or while it holds nothing at all; the
+ *               rest wait as input, and the client is not read from while
+ *               SERVER_READ_SIZE bytes of it are waiting. So a client that
+ *               pipelines requests but does not read the answers cannot
+ *               make the server hold more than about SERVER_MAX_OUTPUT for
+ *               it, and no more than SERVER_MAX_CONNECTIONS clients are
+ *               served at once. On SIGINT or SIGTERM the
+ *               workers are stopped, every connection is closed, a Unix
+ *               socket file is removed and the request count is reported.
+ * PARAMETERS  : QueryServer& server - A server set up by openServer.
+ */
+void runServer(QueryServer& server) {
+#ifdef __linux__
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int workerCount = max(1, (int)thread::hardware_concurrency());
+    vector<thread> workers;
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(thread(serverWorker, ref(server)));
+    }
+    fprintf(statusOutput, "Serving queries on %s with %d worker thread(s); press Ctrl+C to stop\n", server.address, workerCount);
+    fflush(statusOutput);
+
+    epoll_event events[SERVER_MAX_EVENTS];
+    bool running = true;
+    while (running) {
+        int count = epoll_wait(server.poller, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            fprintf(stderr, "Event loop failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &server.listener) {
+                acceptConnections(server);
+            }
+            else if (tag == &server.wakeup) {
+                collectFinishedJobs(server);
+            }
+            else if (tag == &server.signals) {
+                running = false;
+            }
+            else {
+                ServerConnection* connection = (ServerConnection*)tag;
+                if (connection->socket < 0) {
+                    // Closed earlier in this round of events
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    readConnection(server, connection);
+                }
+                if (events[i].events & EPOLLOUT) {
+                    // Sending frees room for lines that were waiting on the output limit
+                    writeConnection(connection);
+                    dispatchLines(server, connection);
+                }
+                updateConnection(server, connection);
+            }
+        }
+        for (ServerConnection* connection : server.closed) {
+            delete connection;
+        }
+        server.closed.clear();
+    }
+
+    // Stop the workers first, so no job is touched while the connections are freed
+    {
+        lock_guard<mutex> guard(server.lock);
+        server.stopping = true;
+    }
+    server.available.notify_all();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    for (ServerJob* job : server.queued) {
+        delete job;
+    }
+    for (ServerJob* job : server.done) {
+        delete job;
+    }
+    for (ServerJob* job : server.spareJobs) {
+        delete job;
+    }
+    for (ServerConnection* connection : server.connections) {
+        for (ServerJob* job : connection->finished) {
+            delete job;
+        }
+        close(connection->socket);
+        delete connection;
+    }
+    closeServer(server);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOutput, "Served %lld requests on %lld connection(s) in %.3f s", server.requests, server.accepted, seconds);
+    if (server.refused > 0) {
+        fprintf(statusOutput, " (%lld refused with %d already open)", server.refused, SERVER_MAX_CONNECTIONS);
+    }
+    fprintf(statusOutput, "\n");
+#else
+    (void)server;
+#endif
+}
+
+#ifdef __linux__
+/*
+ * FUNCTION    : serverWorker
+ * DESCRIPTION : Takes request lines off the server's queue and runs them
+ *               through runBatchQuery, collecting the rows in the job's
+ *               response, at most SERVER_MAX_ROWS parcels. Finished jobs are handed back to the event loop,
+ *               which is woken through the eventfd when the hand-back list
+ *               was empty; otherwise a wake-up is already on its way.
+ * PARAMETERS  : QueryServer& server - The server whose queue is served.
+ */
+void serverWorker(QueryServer& server) {
+    BatchWriter writer(nullptr, server.format);
+    writer.rowLimit = SERVER_MAX_ROWS;
+    unique_lock<mutex> guard(server.lock);
+    while (true) {
+        server.available.wait(guard, [&server] { return server.stopping || !server.queued.empty(); });
+        if (server.stopping) {
+            return;
+        }
+        ServerJob* job = server.queued.front();
+        server.queued.pop_front();
+        guard.unlock();
+
+        job->response.clear();
+        writer.sink = &job->response;
+        if (job->line.empty()) {
+            writer.writeError(job->query, "", "", "line too long");
+        }
+        else {
+            runBatchQuery(*server.hashTable, writer, job->query, job->line.data());
+        }
+        writer.flush();
+        job->response.push_back('\n');
+
+        guard.lock();
+        server.done.push_back(job);
+        if (server.done.size() == 1) {
+            uint64_t one = 1;
+            ssize_t written = write(server.wakeup, &one, sizeof(one));
+            (void)written;
+        }
+    }
+}
+
+/*
+ * FUNCTION    : closeServer
+ * DESCRIPTION : Closes whichever of the server's listening socket, eventfd,
+ *               signalfd and epoll instance are open, and removes the socket
+ *               file of a Unix socket server. Used when the server stops, and
+ *               when setting it up or loading the index fails after the
+ *               listener was bound.
+ * PARAMETERS  : QueryServer& server - The server to close.
+ */
+void closeServer(QueryServer& server) {
+#ifdef __linux__
+    int* descriptors[] = { &server.poller, &server.wakeup, &server.signals, &server.listener };
+    for (int* descriptor : descriptors) {
+        if (*descriptor >= 0) {
+            close(*descriptor);
+            *descriptor = -1;
+        }
+    }
+    if (server.address && strchr(server.address, '/')) {
+        unlink(server.address);
+    }
+#else
+    (void)server;
+#endif
+}
+
+/*
+ * FUNCTION    : openSocket
+ * DESCRIPTION : Creates a stream socket for an address given on the command
+ *               line and binds and listens on it, or connects it. An address
+ *               with a '/' is a Unix socket path; a socket file left there
+ *               by an earlier server is removed before binding if nothing
+ *               answers on it, and the address is refused as in use if a
+ *               server does. Any
+ *               other address is a TCP [host:]port with the host defaulting
+ *               to 127.0.0.1. TCP sockets have Nagle's algorithm turned off,
+ *               since requests and responses are small and pipelined. The
+ *               server takes unauthenticated changes, so unless told
+ *               otherwise it only listens on loopback addresses.
+ * PARAMETERS  : const char* address - The socket path or [host:]port.
+ *               bool listening      - True to listen, false to connect.
+ *               bool loopbackOnly   - True to refuse to listen on a TCP host
+ *                                     outside 127.0.0.0/8.
+ * RETURNS     : int - The socket, or -1 if it could not be opened.
+ */
+int openSocket(const char* address, bool listening, bool loopbackOnly) {
+    int descriptor;
+    int result;
+    if (strchr(address, '/')) {
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(local.sun_path)) {
+            fprintf(stderr, "Socket path is too long: %s\n", address);
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (descriptor < 0) {
+            fprintf(stderr, "Failed to create a socket: %s\n", strerror(errno));
+            return -1;
+        }
+        struct stat info;
+        if (listening && lstat(address, &info) == 0 && S_ISSOCK(info.st_mode)) {
+            // Only a socket file nothing answers on is stale; one with a server behind it is in use
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool live = probe >= 0 && connect(probe, (sockaddr*)&local, sizeof(local)) == 0;
+            bool stale = probe >= 0 && !live && errno == ECONNREFUSED;
+            if (probe >= 0) {
+                close(probe);
+            }
+            if (!stale) {
+                fprintf(stderr, "Failed to listen on %s: %s\n", address, live ? "address in use by a running server" : strerror(errno));
+                close(descriptor);
+                return -1;
+            }
+            unlink(address);
+        }
+        result = listening ? ::bind(descriptor, (sockaddr*)&local, sizeof(local)) : connect(descriptor, (sockaddr*)&local, sizeof(local));
+    }
+    else {
+        char host[64] = "127.0.0.1";
+        const char* port = address;
+        const char* colon = strrchr(address, ':');
+        if (colon) {
+            size_t hostLength = colon - address;
+            if (hostLength >= sizeof(host)) {
+                fprintf(stderr, "Bad address: %s\n", address);
+                return -1;
+            }
+            if (hostLength > 0) {
+                memcpy(host, address, hostLength);
+                host[hostLength] = '\0';
+            }
+            port = colon + 1;
+        }
+        double number;
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        if (!parseNumberOption(port, 1, 65535, number) || number != floor(number) || inet_pton(AF_INET, host, &remote.sin_addr) != 1) {
+            fprintf(stderr, "Bad address: %s (expected a socket path or [host:]port)\n", address);
+            return -1;
+        }
+        if (listening && loopbackOnly && (ntohl(remote.sin_addr.s_addr) >> 24) != 127) {
+            fprintf(stderr, "Refusing to serve on %s: the server takes unauthenticated changes, so it only listens on "
+                "127.0.0.0/8 unless --allow-remote is given\n", host);
+            return -1;
+        }
+        remote.sin_port = htons((uint16_t)number);
+        descriptor = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (descriptor < 0) {
+            fprintf(stderr, "Failed to create a socket: %s\n", strerror(errno));
+            return -1;
+        }
+        int one = 1;
+        setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (listening) {
+            setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        result = listening ? ::bind(descriptor, (sockaddr*)&remote, sizeof(remote)) : connect(descriptor, (sockaddr*)&remote, sizeof(remote));
+    }
+    if (result == 0 && listening) {
+        result = listen(descriptor, SOMAXCONN);
+    }
+    if (result != 0) {
+        fprintf(stderr, "Failed to %s %s: %s\n", listening ? "listen on" : "connect to", address, strerror(errno));
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+/*
+ * FUNCTION    : acceptConnections
+ * DESCRIPTION : Accepts every connection waiting on the listening socket and
+ *               registers each with epoll for reading. Once
+ *               SERVER_MAX_CONNECTIONS are open, new ones are closed straight
+ *               away, so the client finds out at once instead of waiting in
+ *               the backlog.
+ * PARAMETERS  : QueryServer& server - The server accepting connections.
+ */
+void acceptConnections(QueryServer& server) {
+    int client;
+    while ((client = accept4(server.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (server.connections.size() >= SERVER_MAX_CONNECTIONS) {
+            close(client);
+            server.refused++;
+            continue;
+        }
+        // Fails harmlessly on Unix sockets
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ServerConnection* connection = new ServerConnection(client);
+        connection->index = server.connections.size();
+        server.connections.push_back(connection);
+        server.accepted++;
+        updateConnection(server, connection);
+    }
+}
+
+/*
+ * FUNCTION    : readConnection
+ * DESCRIPTION : Reads once from a client socket and makes jobs of the
+ *               complete lines received. epoll is level-triggered, so
+ *               anything left unread brings the event loop back here.
+ * PARAMETERS  : QueryServer& server            - The server the client is on.
+ *               ServerConnection* connection   - The client to read from.
+ */
+void readConnection(QueryServer& server, ServerConnection* connection) {
+    char buffer[SERVER_READ_SIZE];
+    ssize_t length = recv(connection->socket, buffer, sizeof(buffer), 0);
+    if (length > 0) {
+        connection->input.insert(connection->input.end(), buffer, buffer + length);
+    }
+    else if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        connection->peerClosed = true;
+    }
+    dispatchLines(server, connection);
+}
+
+/*
+ * FUNCTION    : dispatchLines
+ * DESCRIPTION : Turns a connection's complete input lines into jobs, stopping
+ *               once SERVER_MAX_IN_FLIGHT are outstanding or the next line's
+ *               largest possible response would take the connection past
+ *               SERVER_MAX_OUTPUT, and queues them for the workers in one
+ *               go. A connection holding nothing always gets its next line
+ *               run, so a large response is never stuck. Commands are numbered the way
+ *               --batch numbers them. A line longer than --batch accepts is
+ *               answered with a "line too long" error as soon as that much
+ *               has arrived, and the rest of it is dropped as it comes in.
+ * PARAMETERS  : QueryServer& server            - The server the client is on.
+ *               ServerConnection* connection   - The client whose input is split.
+ */
+void dispatchLines(QueryServer& server, ServerConnection* connection) {
+    const size_t maxLength = MAX_COUNTRY_NAME_LENGTH + 100 - 2;  // The longest line, without its newline, --batch reads whole
+    vector<char>& input = connection->input;
+    size_t start = 0;
+    while (start < input.size() && connection->inFlight < SERVER_MAX_IN_FLIGHT && !connection->broken) {
+        char* newline = (char*)memchr(input.data() + start, '\n', input.size() - start);
+        size_t end = newline ? newline - input.data() : input.size();
+        bool complete = newline || connection->peerClosed;
+        if (connection->discarding) {
+            connection->discarding = !complete;
+            start = newline ? end + 1 : end;
+            continue;
+        }
+        if (!complete && end - start <= maxLength) {
+            break;
+        }
+        size_t reserve = end - start > maxLength ? boundResponseSize(nullptr, nullptr, server.format) :
+            boundResponseSize(input.data() + start, input.data() + end, server.format);
+        if (connection->held > 0 && connection->held + reserve > SERVER_MAX_OUTPUT) {
+            break;
+        }
+
+        ServerJob* job;
+        if (server.spareJobs.empty()) {
+            job = new ServerJob();
+        }
+        else {
+            job = server.spareJobs.back();
+            server.spareJobs.pop_back();
+        }
+        job->connection = connection;
+        job->sequence = connection->nextSequence++;
+        job->line.clear();
+        if (end - start > maxLength) {
+            job->query = ++connection->queries;
+            connection->discarding = !complete;
+        }
+        else {
+            job->line.assign(input.begin() + start, input.begin() + end);
+            job->line.push_back('\0');
+            const char* c = job->line.data();
+            while (*c && isspace((unsigned char)*c)) {
+                c++;
+            }
+            job->query = *c && *c != '#' ? ++connection->queries : 0;
+        }
+        job->reserved = reserve;
+        connection->held += reserve;
+        connection->inFlight++;
+        server.requests++;
+        server.dispatched.push_back(job);
+        start = newline ? end + 1 : end;
+    }
+    input.erase(input.begin(), input.begin() + start);
+
+    if (!server.dispatched.empty()) {
+        {
+            lock_guard<mutex> guard(server.lock);
+            server.queued.insert(server.queued.end(), server.dispatched.begin(), server.dispatched.end());
+        }
+        if (server.dispatched.size() == 1) {
+            server.available.notify_one();
+        }
+        else {
+            server.available.notify_all();
+        }
+        server.dispatched.clear();
+    }
+}
+
+/*
+ * FUNCTION    : boundResponseSize
+ * DESCRIPTION : Works out the most bytes the server's response to a request
+ *               line can take, so the line can be held against its
+ *               connection's SERVER_MAX_OUTPUT before it runs. Every row
+ *               repeats the command and country, both pieces of the line,
+ *               quoted as BatchWriter::appendQuoted quotes them, with at
+ *               most SERVER_ROW_OVERHEAD bytes of other fields. The listing
+ *               commands give up to SERVER_MAX_ROWS parcel rows, a totals
+ *               row and a row saying the rest were cut off, and the top-K
+ *               commands up to k parcel rows and that row. Every other line
+ *               gives at most three rows.
+ * PARAMETERS  : const char* begin  - First character of the line.
+ *               const char* end    - One past its last character, before the newline.
+ *               BatchFormat format - The format the rows are written in.
+ * RETURNS     : size_t - The largest the response can be, its empty line included.
+ */
+size_t boundResponseSize(const char* begin, const char* end, BatchFormat format) {
+    size_t quoted = 4;  // The quotes around the command and the country
+    for (const char* c = begin; c < end; c++) {
+        unsigned char character = (unsigned char)*c;
+        if (character == '"' || (format == BATCH_JSONL && character == '\\')) {
+            quoted += 2;
+        }
+        else if (format == BATCH_JSONL && character < 0x20) {
+            quoted += 6;
+        }
+        else {
+            quoted++;
+        }
+    }
+
+    // Pick out the command and, for the top-K commands, the third token, which is k
+    const char* tokens[3];
+    size_t lengths[3];
+    const char* c = begin;
+    for (int i = 0; i < 3; i++) {
+        while (c < end && isspace((unsigned char)*c)) {
+            c++;
+        }
+        tokens[i] = c;
+        while (c < end && !isspace((unsigned char)*c)) {
+            c++;
+        }
+        lengths[i] = c - tokens[i];
+    }
+    auto isCommand = [&tokens, &lengths](const char* name) {
+        return lengths[0] == strlen(name) && memcmp(tokens[0], name, lengths[0]) == 0;
+    };
+    long long rows = 3;
+    if (isCommand("list") || isCommand("range") || isCommand("heavier") || isCommand("lighter")) {
+        rows = SERVER_MAX_ROWS + 2;
+    }
+    else if (isCommand("cheapest") || isCommand("costliest") || isCommand("heaviest")) {
+        int k;
+        if (parseWeight(tokens[2], tokens[2] + lengths[2], k) && k > 2) {
+            rows = (k < SERVER_MAX_ROWS ? k : SERVER_MAX_ROWS) + 1;
+        }
+    }
+    return (size_t)rows * (quoted + SERVER_ROW_OVERHEAD) + 1;
+}
+
+/*
+ * FUNCTION    : collectFinishedJobs
+ * DESCRIPTION : Takes the jobs the workers have finished, slots each into
+ *               its connection's reorder ring, and moves every response
+ *               that is next in line into the connection's output. Each
+ *               connection touched is then sent to, given more of its
+ *               waiting lines and re-registered or closed.
+ * PARAMETERS  : QueryServer& server - The server whose workers finished.
+ */
+void collectFinishedJobs(QueryServer& server) {
+    uint64_t count;
+    ssize_t length = read(server.wakeup, &count, sizeof(count));
+    (void)length;
+    vector<ServerJob*> finished;
+    {
+        lock_guard<mutex> guard(server.lock);
+        finished.swap(server.done);
+    }
+    for (ServerJob* job : finished) {
+        // The connection now holds the response itself rather than the room reserved for it
+        ServerConnection* connection = job->connection;
+        connection->finished[job->sequence % SERVER_MAX_IN_FLIGHT] = job;
+        connection->held = connection->held - job->reserved + job->response.size();
+    }
+    for (ServerJob* job : finished) {
+        ServerConnection* connection = job->connection;
+        ServerJob* next;
+        bool delivered = false;
+        while ((next = connection->finished[connection->nextResponse % SERVER_MAX_IN_FLIGHT]) != nullptr) {
+            if (!connection->broken) {
+                connection->output.insert(connection->output.end(), next->response.begin(), next->response.end());
+            }
+            else {
+                connection->held -= next->response.size();
+            }
+            connection->finished[connection->nextResponse % SERVER_MAX_IN_FLIGHT] = nullptr;
+            connection->nextResponse++;
+            connection->inFlight--;
+            server.spareJobs.push_back(next);
+            delivered = true;
+        }
+        if (delivered) {
+            writeConnection(connection);
+            dispatchLines(server, connection);
+            updateConnection(server, connection);
+        }
+    }
+    // Hand the list back so its capacity is reused
+    lock_guard<mutex> guard(server.lock);
+    if (server.done.empty()) {
+        finished.clear();
+        server.done.swap(finished);
+    }
+}
+
+/*
+ * FUNCTION    : writeConnection
+ * DESCRIPTION : Sends a connection's pending output until it is all sent or
+ *               the socket's buffer is full. A failed send marks the
+ *               connection broken; what was not sent is dropped.
+ * PARAMETERS  : ServerConnection* connection - The client to send to.
+ */
+void writeConnection(ServerConnection* connection) {
+    vector<char>& output = connection->output;
+    while (connection->sent < output.size() && !connection->broken) {
+        ssize_t length = send(connection->socket, output.data() + connection->sent, output.size() - connection->sent, MSG_NOSIGNAL);
+        if (length > 0) {
+            connection->sent += length;
+            connection->held -= length;
+        }
+        else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else if (length == 0 || errno != EINTR) {
+            connection->broken = true;
+        }
+    }
+    if (connection->broken || connection->sent == output.size()) {
+        connection->held -= output.size() - connection->sent;
+        output.clear();
+        connection->sent = 0;
+    }
+    else if (connection->sent >= SERVER_READ_SIZE) {
+        // Drop what was sent, so a slow reader does not make the buffer grow without bound
+        output.erase(output.begin(), output.begin() + connection->sent);
+        connection->sent = 0;
+    }
+}
+
+/*
+ * FUNCTION    : updateConnection
+ * DESCRIPTION : Closes a connection once it has nothing more to do: the
+ *               client has stopped sending (or cannot be sent to), every
+ *               job is back and every response is sent. Otherwise it works
+ *               out whether the connection should be read from, which it
+ *               is not while SERVER_READ_SIZE bytes of its input are
+ *               waiting to be run, and whether it is waiting to send,
+ *               and brings its epoll registration in line. A connection
+ *               waiting on neither is taken out of epoll altogether, so a
+ *               hung-up socket does not keep reporting while its jobs run.
+ * PARAMETERS  : QueryServer& server            - The server the client is on.
+ *               ServerConnection* connection   - The client to update.
+ */
+void updateConnection(QueryServer& server, ServerConnection* connection) {
+    if (connection->socket < 0) {
+        return;
+    }
+    bool unsent = connection->sent < connection->output.size();
+    if (connection->inFlight == 0 && (connection->broken || (connection->peerClosed && connection->input.empty() && !unsent))) {
+        if (connection->events != 0) {
+            epoll_ctl(server.poller, EPOLL_CTL_DEL, connection->socket, nullptr);
+        }
+        close(connection->socket);
+        connection->socket = -1;
+        server.connections.back()->index = connection->index;
+        server.connections[connection->index] = server.connections.back();
+        server.connections.pop_back();
+        server.closed.push_back(connection);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!connection->peerClosed && !connection->broken && connection->input.size() < SERVER_READ_SIZE) {
+        events |= EPOLLIN;
+    }
+    if (unsent) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection->events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.ptr = connection;
+        int operation = connection->events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+        epoll_ctl(server.poller, operation, connection->socket, &event);
+        connection->events = events;
+    }
+}
+#endif
+
+/*
+ * FUNCTION    : runLoadGenerator
+ * DESCRIPTION : Drives a query server the way many clients would. The
+ *               command lines of a file (blank lines and comments left out)
+ *               are sent round-robin over several connections, each on its
+ *               own thread keeping up to 'pipeline' requests in flight.
+ *               Every response is timed from when its request was sent to
+ *               when its closing empty line arrived, into a LatencyHistogram
+ *               so memory does not grow with the request count, and the
+ *               request rate, p50, p99 (within 12.5%) and worst latency are
+ *               printed at the end.
+ * PARAMETERS  : const char* address      - The server's socket path or [host:]port.
+ *               const char* commandsPath - File of batch commands to send.
+ *               int connections          - Connections to open.
+ *               long long requests       - Requests to send in all.
+ *               int pipeline             - Most requests in flight on each connection.
+ * RETURNS     : bool - Returns false if the commands could not be read or a
+ *               connection failed.
+ */
+bool runLoadGenerator(const char* address, const char* commandsPath, int connections, long long requests, int pipeline) {
+#ifdef __linux__
+    FILE* input = fopen(commandsPath, "r");
+    if (!input) {
+        fprintf(stderr, "Failed to open command file %s\n", commandsPath);
+        return false;
+    }
+    vector<vector<char>> commands;
+    char line[MAX_COUNTRY_NAME_LENGTH + 100];
+    while (fgets(line, sizeof(line), input)) {
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            // Leave out an overlong line rather than send it in pieces
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n') {
+            }
+            continue;
+        }
+        const char* c = line;
+        while (*c && isspace((unsigned char)*c)) {
+            c++;
+        }
+        if (!*c || *c == '#') {
+            continue;
+        }
+        vector<char> command(line, line + length);
+        if (command.back() != '\n') {
+            command.push_back('\n');
+        }
+        commands.push_back(command);
+    }
+    fclose(input);
+    if (commands.empty()) {
+        fprintf(stderr, "No commands in %s\n", commandsPath);
+        return false;
+    }
+
+    // Spread the requests evenly, each connection starting at a different command
+    // Latencies go into a histogram, so any number of requests is measured in fixed memory
+    LatencyHistogram latencies;
+    vector<LoadClient> clients(connections);
+    for (int i = 0; i < connections; i++) {
+        clients[i].latencies = &latencies;
+        clients[i].address = address;
+        clients[i].commands = &commands;
+        clients[i].firstCommand = (size_t)i * commands.size() / connections;
+        clients[i].requests = requests / connections + (i < requests % connections ? 1 : 0);
+        clients[i].pipeline = pipeline;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 1; i < connections; i++) {
+        threads.push_back(thread(loadClient, ref(clients[i])));
+    }
+    loadClient(clients[0]);
+    for (thread& t : threads) {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    long long rows = 0;
+    int failed = 0;
+    for (LoadClient& client : clients) {
+        rows += client.rows;
+        failed += client.failed ? 1 : 0;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%d of %d connections failed\n", failed, connections);
+        return false;
+    }
+    long long answered = latencies.count.load();
+    printf("Sent %lld requests over %d connection(s) with up to %d in flight on each\n", answered, connections, pipeline);
+    printf("%.3f s, %.0f requests/s, %.1f rows per response\n", seconds, seconds > 0 ? answered / seconds : 0.0,
+        answered > 0 ? (double)rows / answered : 0.0);
+    if (answered > 0) {
+        printf("Latency p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies.percentile(0.50) / 1000.0,
+            latencies.percentile(0.99) / 1000.0, latencies.maxNanoseconds.load() / 1000.0);
+    }
+    return true;
+#else
+    (void)commandsPath;
+    (void)connections;
+    (void)requests;
+    (void)pipeline;
+    fprintf(stderr, "Cannot load %s: --loadgen needs Linux sockets\n", address);
+    return false;
+#endif
+}
+
+/*
+ * FUNCTION    : loadClient
+ * DESCRIPTION : Sends one load generator connection's share of the requests,
+ *               writing more whenever fewer than 'pipeline' are in flight,
+ *               and reads responses as they come. A response ends at an
+ *               empty line, so the client only scans for newlines, counting
+ *               the other lines as result rows. Send times wait in a ring,
+ *               since responses come back in request order.
+ * PARAMETERS  : LoadClient& client - The connection's settings and results.
+ */
+void loadClient(LoadClient& client) {
+#ifdef __linux__
+    int descriptor = openSocket(client.address, false, false);
+    if (descriptor < 0) {
+        client.failed = true;
+        return;
+    }
+    const vector<vector<char>>& commands = *client.commands;
+    vector<chrono::steady_clock::time_point> sentAt(client.pipeline);
+    vector<char> outgoing;
+    char incoming[SERVER_READ_SIZE];
+    size_t next = client.firstCommand;
+    long long sent = 0;
+    long long answered = 0;
+    bool lineStart = true;
+    while (answered < client.requests) {
+        outgoing.clear();
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        while (sent < client.requests && sent - answered < client.pipeline) {
+            outgoing.insert(outgoing.end(), commands[next].begin(), commands[next].end());
+            next = (next + 1) % commands.size();
+            sentAt[sent % client.pipeline] = now;
+            sent++;
+        }
+        for (size_t offset = 0; offset < outgoing.size();) {
+            ssize_t length = send(descriptor, outgoing.data() + offset, outgoing.size() - offset, MSG_NOSIGNAL);
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            if (length <= 0) {
+                client.failed = true;
+                close(descriptor);
+                return;
+            }
+            offset += length;
+        }
+
+        ssize_t length = recv(descriptor, incoming, sizeof(incoming), 0);
+        if (length <= 0) {
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            client.failed = true;
+            break;
+        }
+        chrono::steady_clock::time_point arrived = chrono::steady_clock::now();
+        for (const char* c = incoming; c < incoming + length;) {
+            const char* newline = (const char*)memchr(c, '\n', incoming + length - c);
+            if (!newline) {
+                lineStart = false;
+                break;
+            }
+            if (lineStart && newline == c) {
+                client.latencies->record(chrono::duration_cast<chrono::nanoseconds>(arrived - sentAt[answered % client.pipeline]).count());
+                answered++;
+            }
+            else {
+                client.rows++;
+            }
+            lineStart = true;
+            c = newline + 1;
+        }
+    }
+    close(descriptor);
+#else
+    client.failed = true;
+#endif
+}
+
+/*
+ * FUNCTION    : generateManifest
+ * DESCRIPTION : Writes a synthetic manifest for testing and benchmarking.
+ *               Countries are named Country0001, Country0002 and so on and
+ *               picked with Zipf-distributed frequencies, so a skew of 0
+ *               gives an even mix and larger values make the first few
+ *               countries dominate. Weights come from the chosen
+ *               distribution and valuations are uniform between 10.00 and
+ *               2000.00. For sorted and reversed orders the weights are
+ *               drawn into a histogram first and written out in order, so
+ *               even 1e8 rows need no more memory than the random order.
+ * PARAMETERS  : const char* path                 - The manifest to write.
+ *               const GeneratorOptions& options  - The shape of the manifest.
+ * RETURNS     : bool - Returns false if the file could not be written.
+ */
+bool generateManifest(const char* path, const GeneratorOptions& options) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to create manifest %s\n", path);
+        return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, GENERATE_BUFFER_SIZE);
+
+    // Cumulative Zipf frequencies of the countries, searched with each uniform draw
+    vector<double> cumulative(options.countries);
+    double total = 0;
+    for (int i = 0; i < options.countries; i++) {
+        total += 1.0 / pow(i + 1.0, options.skew);
+        cumulative[i] = total;
+    }
+    RandomGenerator random(options.seed);
+    bool written = true;
+    if (options.order == ROWS_RANDOM) {
+        for (long long row = 0; row < options.rows && written; row++) {
+            int weight = drawWeight(random, options.weights);
+            written = writeGeneratedRow(file, random, cumulative, weight);
+        }
+    }
+    else {
+        vector<long long> histogram(GENERATE_MAX_WEIGHT + 1, 0);
+        for (long long row = 0; row < options.rows; row++) {
+            histogram[drawWeight(random, options.weights)]++;
+        }
+        for (int i = 1; i <= GENERATE_MAX_WEIGHT && written; i++) {
+            int weight = options.order == ROWS_SORTED ? i : GENERATE_MAX_WEIGHT + 1 - i;
+            for (long long j = 0; j < histogram[weight] && written; j++) {
+                written = writeGeneratedRow(file, random, cumulative, weight);
+            }
+        }
+    }
+    written = (fclose(file) == 0) && written;
+    if (!written) {
+        printf("Failed to write manifest %s\n", path);
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Generated %lld parcels for %d countries in %s in %.3f s\n", options.rows, options.countries, path, seconds);
+    return true;
+}
+
+/*
+ * FUNCTION    : drawWeight
+ * DESCRIPTION : Draws one parcel weight between 1 and GENERATE_MAX_WEIGHT.
+ * PARAMETERS  : RandomGenerator& random           - The generator to draw from.
+ *               WeightDistribution distribution   - The distribution to follow.
+ * RETURNS     : int - The weight.
+ */
+int drawWeight(RandomGenerator& random, WeightDistribution distribution) {
+    double weight;
+    if (distribution == WEIGHTS_NORMAL) {
+        // Box-Muller transform, centred on the middle of the range with a sixth of it as the deviation
+        weight = GENERATE_MAX_WEIGHT / 2.0 + GENERATE_MAX_WEIGHT / 6.0 * sqrt(-2 * log(random.uniform())) * cos(6.283185307179586 * random.uniform());
+    }
+    else if (distribution == WEIGHTS_EXPONENTIAL) {
+        weight = 1 - GENERATE_MAX_WEIGHT / 10.0 * log(random.uniform());
+    }
+    else {
+        weight = 1 + random.below(GENERATE_MAX_WEIGHT);
+    }
+    if (weight < 1) {
+        return 1;
+    }
+    return weight > GENERATE_MAX_WEIGHT ? GENERATE_MAX_WEIGHT : (int)weight;
+}
+
+/*
+ * FUNCTION    : writeGeneratedRow
+ * DESCRIPTION : Writes one manifest row with the given weight, a country
+ *               drawn from the cumulative frequencies and a random valuation.
+ * PARAMETERS  : FILE* file                        - The manifest being written.
+ *               RandomGenerator& random           - The generator to draw from.
+ *               const vector<double>& cumulative  - Cumulative country frequencies.
+ *               int weight                        - The parcel's weight.
+ * RETURNS     : bool - Returns false if the row could not be written.
+ */
+bool writeGeneratedRow(FILE* file, RandomGenerator& random, const vector<double>& cumulative, int weight) {
+    double pick = random.uniform() * cumulative.back();
+    size_t country = lower_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+    if (country >= cumulative.size()) {
+        country = cumulative.size() - 1;
+    }
+    int cents = 1000 + random.below(199001);
+    return fprintf(file, "Country%04d %d %d.%02d\n", (int)country + 1, weight, cents / 100, cents % 100) > 0;
+}
+
+/*
+ * FUNCTION    : runBenchmark
+ * DESCRIPTION : Measures the loaded index: the time the load took, the
+ *               memory used per parcel, and the latency percentiles of every
+ *               menu query. Each query runs through the batch query code on
+ *               a random country with random weights, writing its rows to a
+ *               BatchWriter that discards them, so formatting is timed but
+ *               terminal output is not. Each query type runs
+ *               BENCHMARK_QUERIES times or for BENCHMARK_SECONDS, whichever
+ *               ends first.
+ * PARAMETERS  : HashTable& hashTable - Reference to the loaded hash table.
+ *               double loadSeconds   - How long loading the index took.
+ */
+void runBenchmark(HashTable& hashTable, double loadSeconds) {
+    // Find the countries with parcels and the span of their weights
+    vector<int> countryIds, lightest, heaviest;
+    for (int id = 0; id < countryDictionary.count(); id++) {
+        TreeReader tree = hashTable.getTree(id);
+        if (tree && tree->root) {
+            countryIds.push_back(id);
+            lightest.push_back(tree->first().weight());
+            heaviest.push_back(tree->last().weight());
+        }
+    }
+    IndexMemory memory = hashTable.memoryUsage();
+    if (countryIds.empty()) {
+        printf("No parcels loaded, nothing to benchmark.\n");
+        return;
+    }
+    if (hashTable.shards) {
+        // Only the loaded countries' trees are in memory, so bytes per parcel is over their parcels
+        // alone, and the load time is that of reading the index
+        size_t loadedBytes;
+        {
+            lock_guard<mutex> guard(hashTable.shards->lock);
+            loadedBytes = hashTable.shards->loadedBytes;
+        }
+        printf("Benchmark of %lld parcels in %d countries, loaded lazily from %s\n", hashTable.parcelCount(), (int)countryIds.size(),
+            hashTable.shards->directory);
+        printf("Index read: %.3f s; %.1f tree bytes per parcel over the %lld parcels loaded now\n", loadSeconds,
+            memory.parcels > 0 ? (double)loadedBytes / memory.parcels : 0.0, memory.parcels);
+    }
+    else {
+        printf("Benchmark of %lld parcels in %d countries\n", memory.parcels, (int)countryIds.size());
+        printf("Load: %.3f s, %.0f parcels/s, %.1f bytes per parcel\n", loadSeconds,
+            loadSeconds > 0 ? memory.parcels / loadSeconds : 0.0, (double)memory.reservedBytes / memory.parcels);
+    }
+    printf("\n%-4s %-11s %8s %10s %10s %10s %10s %11s\n", "Menu", "Query", "Queries", "p50 us", "p90 us", "p99 us", "max us", "Rows/query");
+
+    const char* commands[] = { "list", "heavier", "lighter", "range", "totals", "cost", "extremes", "cheapest", "costliest", "heaviest", "percentiles" };
+    const int menuChoices[] = { 1, 2, 2, 2, 3, 4, 5, 8, 8, 8, 8 };
+    RandomGenerator random(BENCHMARK_SEED);
+    BatchWriter writer(nullptr, BATCH_CSV);
+    for (int c = 0; c < (int)(sizeof(commands) / sizeof(commands[0])); c++) {
+        vector<double> latencies;
+        long long rowsBefore = writer.rows;
+        chrono::steady_clock::time_point operationStart = chrono::steady_clock::now();
+        while ((int)latencies.size() < BENCHMARK_QUERIES &&
+            chrono::duration<double>(chrono::steady_clock::now() - operationStart).count() < BENCHMARK_SECONDS) {
+            // Pick a country and a weight inside its span, and a range of about a hundredth of the span
+            int i = random.below((int)countryIds.size());
+            long long span = (long long)heaviest[i] - lightest[i] + 1;
+            int weight = (int)(lightest[i] + (long long)(random.uniform() * span));
+            int upper = (int)(weight + span / 100 < INT_MAX ? weight + span / 100 : INT_MAX);
+            char line[MAX_COUNTRY_NAME_LENGTH + 64];
+            const char* country = countryDictionary.name(countryIds[i]);
+            if (strcmp(commands[c], "range") == 0) {
+                snprintf(line, sizeof(line), "%s %s %d %d", commands[c], country, weight, upper);
+            }
+            else if (strcmp(commands[c], "heavier") == 0 || strcmp(commands[c], "lighter") == 0) {
+                snprintf(line, sizeof(line), "%s %s %d", commands[c], country, weight);
+            }
+            else if (strcmp(commands[c], "cheapest") == 0 || strcmp(commands[c], "costliest") == 0 || strcmp(commands[c], "heaviest") == 0) {
+                snprintf(line, sizeof(line), "%s %s %d", commands[c], country, BENCHMARK_TOP_K);
+            }
+            else {
+                snprintf(line, sizeof(line), "%s %s", commands[c], country);
+            }
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            runBatchQuery(hashTable, writer, (long long)latencies.size() + 1, line);
+            latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        sort(latencies.begin(), latencies.end());
+        size_t n = latencies.size();
+        printf("%-4d %-11s %8zu %10.2f %10.2f %10.2f %10.2f %11.1f\n", menuChoices[c], commands[c], n,
+            latencies[n / 2], latencies[n * 9 / 10], latencies[n * 99 / 100], latencies[n - 1], (double)(writer.rows - rowsBefore) / n);
+    }
+    if (writer.errors > 0) {
+        printf("%lld queries failed\n", writer.errors);
+    }
+}
+
+/*
+ * FUNCTION    : parseNumberOption
+ * DESCRIPTION : Parses the value of a numeric command line option.
+ * PARAMETERS  : const char* text  - The option's value.
+ *               double minimum    - Smallest value allowed.
+ *               double maximum    - Largest value allowed.
+ *               double& value     - Receives the number.
+ * RETURNS     : bool - Returns false if the text is not a number in range.
+ */
+bool parseNumberOption(const char* text, double minimum, double maximum, double& value) {
+    char* end;
+    value = strtod(text, &end);
+    return end != text && *end == '\0' && value >= minimum && value <= maximum;
+}
+
+/*
+ * FUNCTION    : printUsage
+ * DESCRIPTION : Prints the command line options.
+ * PARAMETERS  : const char* program - The name the program was run as.
+ */
+void printUsage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --manifest <file>         Load parcels from <file> instead of couriers.txt\n");
+    printf("  --no-snapshot             Neither read nor write <manifest>.snapshot\n");
+    printf("  --columnar                Answer totals, cost and lightest/heaviest from column copies\n");
+    printf("  --follow                  Insert parcels appended to the manifest while the menu runs\n");
+    printf("  --batch <file|->          Run query commands from a file or stdin instead of the menu\n");
+    printf("  --format csv|jsonl        Format of the --batch and --serve results and --report (default csv)\n");
+    printf("  --report [-]<column>      Write every country's count, totals and extremes sorted by a column\n");
+    printf("                            (country, count, total_weight, total_valuation, min_weight,\n");
+    printf("                            max_weight, min_valuation or max_valuation; '-' for largest first)\n");
+    printf("  --serve <address>         Answer --batch commands from clients instead of showing the menu, on a\n");
+    printf("                            Unix socket path or a TCP [host:]port (host 127.0.0.1 by default)\n");
+    printf("    --allow-remote          Let --serve listen on a host outside 127.0.0.0/8\n");
+    printf("  --loadgen <address> <file>  Send the commands in <file> to a server, then report QPS and latency:\n");
+    printf("    --connections <n>       Connections to open (default %d)\n", LOADGEN_CONNECTIONS);
+    printf("    --pipeline <n>          Requests in flight on each connection (default %d)\n", LOADGEN_PIPELINE);
+    printf("    --requests <n>          Requests to send in all (default %d)\n", LOADGEN_REQUESTS);
+    printf("  --partition <dir>         Split the manifest into shard files in <dir> for --lazy, then exit\n");
+    printf("    --shards <n>            Number of shard files (default one per country)\n");
+    printf("  --lazy <dir>              Load each country from a partitioned manifest when it is first used\n");
+    printf("    --memory-budget <MB>    Evict the least recently used countries beyond this (default %d)\n", LAZY_MEMORY_BUDGET_MB);
+    printf("  --stats                   Time loads, inserts and queries for the stats menu option\n");
+    printf("  --stats-json <file>       Time them as --stats does and write the stats to <file> on exit\n");
+    printf("  --benchmark               Time the load and every menu query, then exit\n");
+    printf("  --bench-columns           Compare pointer, scalar and vectorized aggregates, then exit\n");
+    printf("  --stress                  Check readers against a concurrent writer, then exit\n");
+    printf("  --generate <file>         Write a synthetic manifest to <file>, then exit, shaped by:\n");
+    printf("    --rows <n>              Parcels to write (default 100000)\n");
+    printf("    --countries <n>         Countries to spread them over (default 20)\n");
+    printf("    --skew <s>              Zipf exponent of the country mix, 0 for even (default 0)\n");
+    printf("    --weights uniform|normal|exponential   Weight distribution (default uniform)\n");
+    printf("    --order random|sorted|reversed         Row order (default random)\n");
+    printf("    --seed <n>              Random seed (default 1)\n");
+}
+
+/*
+ * FUNCTION    : collectIndexShape
+ * DESCRIPTION : Gathers the shape of every country's tree, in slot order,
+ *               for the stats display and dump. In lazy mode a country that
+ *               is not loaded has its parcel count from the shard index and
+ *               no tree memory.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               size_t& slotCount    - Receives the number of slots in the table.
+ * RETURNS     : vector<CountryShape> - One entry per country in the table.
+ */
+vector<CountryShape> collectIndexShape(HashTable& hashTable, size_t& slotCount) {
+    vector<CountryShape> shapes;
+    shared_lock<ReadWriteLock> guard(hashTable.lock);
+    slotCount = hashTable.table.slots.size();
+    for (size_t slot = 0; slot < hashTable.table.slots.size(); slot++) {
+        if (hashTable.table.slots[slot].distance == 0) {
+            continue;
+        }
+        CountryIndex* entry = hashTable.table.slots[slot].value;
+        shared_lock<ReadWriteLock> entryGuard(entry->lock);
+        CountryShape shape;
+        shape.countryId = entry->countryId;
+        shape.slot = (int)slot;
+        shape.probe = (int)hashTable.table.slots[slot].distance;
+        shape.height = entry->tree.height;
+        shape.resident = entry->resident;
+        entry->tree.addMemoryUsage(shape.memory);
+        shape.parcels = entry->resident ? shape.memory.parcels : entry->shardParcels;
+        shapes.push_back(shape);
+    }
+    return shapes;
+}
+
+/*
+ * FUNCTION    : showStats
+ * DESCRIPTION : Displays the latency of each operation recorded so far, how
+ *               far lookups probe in the hash table, and the height,
+ *               node count and node memory of every country's tree.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ */
+void showStats(HashTable& hashTable) {
+    printf("\n");
+    if (!statsEnabled) {
+        printf("Operation timing is off; start the program with --stats to collect it.\n");
+    }
+    else {
+        printf("%-14s %9s %10s %10s %10s %10s %10s\n", "Operation", "Count", "Mean us", "p50 us", "p90 us", "p99 us", "Max us");
+        for (int i = 0; i < OPERATION_COUNT; i++) {
+            const LatencyHistogram& histogram = operationStats[i];
+            long long count = histogram.count.load();
+            if (count == 0) {
+                continue;
+            }
+            printf("%-14s %9lld %10.2f %10.2f %10.2f %10.2f %10.2f\n", operationNames[i], count,
+                histogram.totalNanoseconds.load() / 1000.0 / count, histogram.percentile(0.5) / 1000.0,
+                histogram.percentile(0.9) / 1000.0, histogram.percentile(0.99) / 1000.0, histogram.maxNanoseconds.load() / 1000.0);
+        }
+    }
+    if (hashTable.shards) {
+        LazyShards& shards = *hashTable.shards;
+        lock_guard<mutex> guard(shards.lock);
+        printf("\n");
+        printf("Lazy loading from %s: %lld loads, %lld evictions, %zu countries loaded in %.1f MB of a %.1f MB budget, %lld changed and kept\n",
+            shards.directory, shards.loads, shards.evictions, shards.loadedCount, shards.loadedBytes / (1024.0 * 1024.0),
+            shards.budget / (1024.0 * 1024.0), shards.pinned);
+    }
+
+    size_t slotCount = 0;
+    vector<CountryShape> shapes = collectIndexShape(hashTable, slotCount);
+    // Countries and parcels found after each number of probes
+    vector<int> probeCountries;
+    vector<long long> probeParcels;
+    long long totalProbes = 0;
+    for (size_t i = 0; i < shapes.size(); i++) {
+        if ((int)probeCountries.size() <= shapes[i].probe) {
+            probeCountries.resize(shapes[i].probe + 1, 0);
+            probeParcels.resize(shapes[i].probe + 1, 0);
+        }
+        probeCountries[shapes[i].probe]++;
+        probeParcels[shapes[i].probe] += shapes[i].parcels;
+        totalProbes += shapes[i].probe;
+    }
+    printf("\n");
+    printf("Hash table: %zu slots, %d countries (%.1f%% full), mean probes %.2f, longest probe %d\n",
+        slotCount, (int)shapes.size(), slotCount > 0 ? 100.0 * shapes.size() / slotCount : 0.0,
+        shapes.empty() ? 0.0 : (double)totalProbes / shapes.size(), (int)probeCountries.size() - 1);
+    printf("%-7s %9s %12s\n", "Probes", "Countries", "Parcels");
+    for (size_t i = 1; i < probeCountries.size(); i++) {
+        printf("%-7d %9d %12lld\n", (int)i, probeCountries[i], probeParcels[i]);
+    }
+
+    printf("\n");
+    printf("%-24s %6s %6s %12s %6s %10s %8s %14s\n", "Country", "Slot", "Probes", "Parcels", "Height", "Leaves", "Inner", "Node memory KB");
+    for (size_t i = 0; i < shapes.size(); i++) {
+        const CountryShape& shape = shapes[i];
+        if (!shape.resident) {
+            printf("%-24s %6d %6d %12lld %6s %10s %8s %14s\n", countryDictionary.name(shape.countryId), shape.slot, shape.probe,
+                shape.parcels, "-", "-", "-", "not loaded");
+            continue;
+        }
+        printf("%-24s %6d %6d %12lld %6d %10lld %8lld %14.1f\n", countryDictionary.name(shape.countryId), shape.slot, shape.probe,
+            shape.parcels, shape.height, shape.memory.leaves, shape.memory.innerNodes, shape.memory.reservedBytes / 1024.0);
+    }
+}
+
+/*
+ * FUNCTION    : dumpStats
+ * DESCRIPTION : Writes the same statistics as showStats to a file as one
+ *               JSON object, for scripts and dashboards to pick up.
+ *               Percentiles are in microseconds.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ *               const char* path     - The file to write.
+ * RETURNS     : bool - Returns false if the file could not be written.
+ */
+bool dumpStats(HashTable& hashTable, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(statusOutput, "Failed to create stats file %s\n", path);
+        return false;
+    }
+    bool written;
+    {
+        BatchWriter writer(file, BATCH_JSONL);
+        writer.append("{\"operations\":{");
+        for (int i = 0; i < OPERATION_COUNT; i++) {
+            const LatencyHistogram& histogram = operationStats[i];
+            long long count = histogram.count.load();
+            writer.append("%s\"%s\":{\"count\":%lld,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}",
+                i == 0 ? "" : ",", operationNames[i], count, count > 0 ? histogram.totalNanoseconds.load() / 1000.0 / count : 0.0,
+                histogram.percentile(0.5) / 1000.0, histogram.percentile(0.9) / 1000.0, histogram.percentile(0.99) / 1000.0,
+                histogram.maxNanoseconds.load() / 1000.0);
+        }
+        size_t slotCount = 0;
+        vector<CountryShape> shapes = collectIndexShape(hashTable, slotCount);
+        writer.append("},\"hash_table\":{\"slots\":%zu,\"countries\":%zu},", slotCount, shapes.size());
+        if (hashTable.shards) {
+            LazyShards& shards = *hashTable.shards;
+            lock_guard<mutex> guard(shards.lock);
+            writer.append("\"lazy\":{\"loads\":%lld,\"evictions\":%lld,\"loaded_countries\":%zu,\"loaded_bytes\":%zu,\"budget_bytes\":%zu,\"changed\":%lld},",
+                shards.loads, shards.evictions, shards.loadedCount, shards.loadedBytes, shards.budget, shards.pinned);
+        }
+        writer.append("\"countries\":[");
+        for (size_t i = 0; i < shapes.size(); i++) {
+            const CountryShape& shape = shapes[i];
+            writer.append("%s{\"name\":", i == 0 ? "" : ",");
+            writer.appendQuoted(countryDictionary.name(shape.countryId));
+            writer.append(",\"slot\":%d,\"probes\":%d,\"parcels\":%lld,\"loaded\":%s,\"height\":%d,\"leaves\":%lld,\"inner_nodes\":%lld,\"node_bytes\":%zu}",
+                shape.slot, shape.probe, shape.parcels, shape.resident ? "true" : "false", shape.height, shape.memory.leaves,
+                shape.memory.innerNodes, shape.memory.reservedBytes);
+        }
+        writer.append("]}\n");
+        writer.flush();
+        written = !writer.failed;
+    }
+    if (fclose(file) != 0 || !written) {
+        fprintf(statusOutput, "Failed to write stats file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * FUNCTION    : reportMemoryUsage
+ * DESCRIPTION : Prints how many bytes the index uses per parcel, next to an
+ *               estimate of what the same index would cost if every parcel,
+ *               its country name and every node were separate heap blocks.
+ * PARAMETERS  : HashTable& hashTable - Reference to the hash table.
+ */
+void reportMemoryUsage(HashTable& hashTable) {
+    IndexMemory memory = hashTable.memoryUsage();
+    if (memory.parcels == 0) {
+        return;
+    }
+    // A separately allocated parcel held a pointer to its own 21-byte name buffer
+    size_t heapParcel = heapBlockSize(sizeof(char*) + sizeof(int) + sizeof(float)) + heapBlockSize(21);
+    double heapBytes = (double)memory.parcels * heapParcel
+        + (double)memory.leaves * heapBlockSize(sizeof(BSTDataNode))
+        + (double)memory.innerNodes * heapBlockSize(sizeof(BSTInnerNode))
+        + (double)memory.entries * heapBlockSize(sizeof(CountryIndex));
+    fprintf(statusOutput, "Index memory: %.1f MB, %.1f bytes per parcel (about %.1f bytes per parcel with one heap block per parcel, name and node)\n",
+        memory.reservedBytes / (1024.0 * 1024.0), (double)memory.reservedBytes / memory.parcels, heapBytes / memory.parcels);
+}
+
+/*
+ * FUNCTION    : heapBlockSize
+ * DESCRIPTION : Estimates the space a general-purpose heap takes for one
+ *               allocation: the request plus an 8-byte header, rounded up to
+ *               16 bytes, with a 32-byte minimum.
+ * PARAMETERS  : size_t bytes - The number of bytes requested.
+ * RETURNS     : size_t - The estimated size of the heap block.
+ */
+size_t heapBlockSize(size_t bytes) {
+    size_t block = (bytes + 8 + 15) / 16 * 16;
+    return block < 32 ? 32 : block;
+}
+
+/*
+ * FUNCTION    : parseChunk
+ * DESCRIPTION : Parses every line of a slice of the manifest into the slice's
+ *               record list. Blank lines are ignored; malformed lines are
+ *               counted, and the first few are remembered by line number.
+ * PARAMETERS  : LoadChunk& chunk - The slice to parse; receives the results.
+ */
+void parseChunk(LoadChunk& chunk) {
+    chunk.records.reserve((chunk.end - chunk.begin) / 24);
+    const char* line = chunk.begin;
+    while (line < chunk.end) {
+        const char* newline = (const char*)memchr(line, '\n', chunk.end - line);
+        const char* lineEnd = newline ? newline : chunk.end;
+
+        // Skip lines that hold nothing but whitespace
+        const char* cursor = line;
+        while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) {
+            cursor++;
+        }
+        if (cursor < lineEnd) {
+            ParcelRecord record;
+            if (parseParcelLine(cursor, lineEnd, record)) {
+                chunk.records.push_back(record);
+            }
+            else {
+                if (chunk.malformed < MAX_REPORTED_MALFORMED_LINES) {
+                    chunk.malformedLines[chunk.malformed] = chunk.lines;
+                }
+                chunk.malformed++;
+            }
+        }
+        chunk.lines++;
+        line = lineEnd + 1;
+    }
+}
+
+/*
+ * FUNCTION    : prepareChunk
+ * DESCRIPTION : Parses a slice of the manifest for a bulk load and resolves
+ *               each record's country to its dictionary ID. The last few
+ *               names seen are cached by hash, so most records find their ID
+ *               without taking the dictionary's lock.
+ * PARAMETERS  : LoadChunk& chunk - The slice to parse; receives the results.
+ */
+void prepareChunk(LoadChunk& chunk) {
+    parseChunk(chunk);
+
+    struct CachedName {
+        uint64_t hash;          // Hash of the name
+        const ParcelRecord* record;  // Earlier record with the name, or nullptr when unused
+        int countryId;          // Dictionary ID of the name
+    };
+    CachedName cache[64] = {};
+    chunk.countryIds.resize(chunk.records.size());
+    for (size_t i = 0; i < chunk.records.size(); i++) {
+        const ParcelRecord& record = chunk.records[i];
+        uint64_t hash = CountryDictionary::hashFunction(record.country, record.countryLength);
+        CachedName& cached = cache[hash % 64];
+        if (!cached.record || cached.hash != hash || cached.record->countryLength != record.countryLength ||
+            memcmp(cached.record->country, record.country, record.countryLength) != 0) {
+            cached.hash = hash;
+            cached.record = &record;
+            cached.countryId = countryDictionary.intern(record.country, record.countryLength);
+        }
+        chunk.countryIds[i] = cached.countryId;
+    }
+}
+
+/*
+ * FUNCTION    : buildCountryTrees
+ * DESCRIPTION : Body of a bulk load build thread. It takes countries off the
+ *               shared list one at a time, sorts each one's run by weight and
+ *               builds its tree directly from the sorted run. The sort is
+ *               stable, so parcels of equal weight keep their file order, as
+ *               they would if inserted one by one.
+ * PARAMETERS  : BulkLoad& load - The runs to build and the list of countries.
+ */
+void buildCountryTrees(BulkLoad& load) {
+    vector<int> weights;
+    vector<int64_t> valuations;
+    for (size_t next = load.next++; next < load.order.size(); next = load.next++) {
+        int countryId = load.order[next];
+        vector<BulkParcel>& run = load.runs[countryId];
+        stable_sort(run.begin(), run.end(), [](const BulkParcel& a, const BulkParcel& b) {
+            return a.weight < b.weight;
+        });
+
+        CountryIndex* entry = load.hashTable->findOrCreateEntry(countryId);
+        unique_lock<ReadWriteLock> guard(entry->lock);
+        if (entry->tree.root) {
+            // The country already has parcels, so the run is merged in the slow way
+            for (size_t i = 0; i < run.size(); i++) {
+                entry->tree.insert(countryId, run[i].weight, run[i].valuation);
+            }
+        }
+        else {
+            weights.resize(run.size());
+            valuations.resize(run.size());
+            for (size_t i = 0; i < run.size(); i++) {
+                weights[i] = run[i].weight;
+                valuations[i] = run[i].valuation;
+            }
+            entry->tree.buildFromSorted(countryId, weights.data(), valuations.data(), run.size());
+        }
+        vector<BulkParcel>().swap(run);  // Release each run as soon as its tree is built
+    }
+}
+
+/*
+ * FUNCTION    : parseParcelLine
+ * DESCRIPTION : Splits one manifest line into its three whitespace-separated
+ *               fields and parses them. Country names longer than
+ *               MAX_COUNTRY_NAME_LENGTH are rejected rather than cut short.
+ * PARAMETERS  : const char* line     - First character of the line.
+ *               const char* end      - One past the last character of the line.
+ *               ParcelRecord& record - Receives the parsed fields.
+ * RETURNS     : bool - Returns true if the line held a valid parcel; false otherwise.
+ */
+bool parseParcelLine(const char* line, const char* end, ParcelRecord& record) {
+    const char* tokens[3];
+    const char* tokenEnds[3];
+    int tokenCount = 0;
+    const char* cursor = line;
+    while (true) {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) {
+            cursor++;
+        }
+        if (cursor == end) {
+            break;
+        }
+        if (tokenCount == 3) {
+            return false;  // Too many fields
+        }
+        tokens[tokenCount] = cursor;
+        while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r') {
+            cursor++;
+        }
+        tokenEnds[tokenCount] = cursor;
+        tokenCount++;
+    }
+    if (tokenCount != 3) {
+        return false;
+    }
+
+    size_t nameLength = tokenEnds[0] - tokens[0];
+    if (nameLength > MAX_COUNTRY_NAME_LENGTH) {
+        return false;
+    }
+    record.country = tokens[0];
+    record.countryLength = (int)nameLength;
+    return parseWeight(tokens[1], tokenEnds[1], record.weight) && parseValuation(tokens[2], tokenEnds[2], record.valuation);
+}
+
+/*
+ * FUNCTION    : parseWeight
+ * DESCRIPTION : Parses a whole token as an optionally signed decimal integer.
+ * PARAMETERS  : const char* begin - First character of the token.
+ *               const char* end   - One past the last character of the token.
+ *               int& weight       - Receives the parsed value.
+ * RETURNS     : bool - Returns false if the token is not a number or does not fit in an int.
+ */
+bool parseWeight(const char* begin, const char* end, int& weight) {
+    bool negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        begin++;
+    }
+    if (begin == end) {
+        return false;
+    }
+    long long value = 0;
+    for (; begin < end; begin++) {
+        if (*begin < '0' || *begin > '9') {
+            return false;
+        }
+        value = value * 10 + (*begin - '0');
+        if (value > (long long)INT_MAX + 1) {
+            return false;
+        }
+    }
+    if (negative) {
+        value = -value;
+    }
+    if (value > INT_MAX) {
+        return false;
+    }
+    weight = (int)value;
+    return true;
+}
+
+/*
+ * FUNCTION    : parseValuation
+ * DESCRIPTION : Parses a whole token as an optionally signed decimal number
+ *               with an optional fractional part, such as 125 or 99.95, into
+ *               whole cents. A third decimal digit rounds the cents half away
+ *               from zero and any digits after it are ignored.
+ * PARAMETERS  : const char* begin  - First character of the token.
+ *               const char* end    - One past the last character of the token.
+ *               int64_t& valuation - Receives the parsed value, in cents.
+ * RETURNS     : bool - Returns false if the token is not a decimal number or
+ *               is too large to hold in cents.
+ */
+bool parseValuation(const char* begin, const char* end, int64_t& valuation) {
+    bool negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        begin++;
+    }
+    int64_t cents = 0;
+    int fractionDigits = 0;     // Digits seen after the decimal point
+    bool seenDigit = false, seenPoint = false, roundUp = false;
+    for (; begin < end; begin++) {
+        if (*begin == '.' && !seenPoint) {
+            seenPoint = true;
+        }
+        else if (*begin >= '0' && *begin <= '9') {
+            seenDigit = true;
+            int digit = *begin - '0';
+            if (!seenPoint) {
+                if (cents > (INT64_MAX / CENTS_PER_UNIT - 1 - digit) / 10) {
+                    return false;
+                }
+                cents = cents * 10 + digit;
+            }
+            else if (fractionDigits < 2) {
+                // The first two fractional digits are the cents
+                fractionDigits++;
+                cents = cents * 10 + digit;
+            }
+            else if (fractionDigits == 2) {
+                fractionDigits++;
+                roundUp = digit >= 5;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    if (!seenDigit) {
+        return false;
+    }
+    // Scale the whole part up to cents for any fractional digits that were missing
+    for (int i = fractionDigits < 2 ? fractionDigits : 2; i < 2; i++) {
+        cents *= 10;
+    }
+    cents += roundUp;
+    valuation = negative ? -cents : cents;
+    return true;
+}
+
+/*
+ * FUNCTION    : getUserInput
+ * DESCRIPTION : Prompts the user for input and stores the result in a buffer.
+ *               The function also removes any trailing newline characters from
+ *               the input string.
+ * PARAMETERS  : const char* prompt - The prompt message to display to the user.
+ *               char* buffer       - The buffer to store the user's input.
+ *               int size           - The size of the buffer.
+ */
+void getUserInput(const char* prompt, char* buffer, int size) {
+    // Function implementation here for getUserInput
+    printf("%s", prompt);
+    fgets(buffer, size, stdin);
+    size_t length = strlen(buffer);
+    if (length > 0 && buffer[length - 1] == '\n') {
+        buffer[length - 1] = '\0';
+    }
+}